@@ -23,7 +23,7 @@ extern "C" {
 #endif
 #endif
 
-#define CENV_VERSION 1
+#define CENV_VERSION 2
 
 // Poissible value types
 typedef enum {
@@ -132,6 +132,55 @@ CENV_API int32_t cenv_step(cenv_key_value* actions, int32_t actions_size); // St
 CENV_API int32_t cenv_render(); // Render the environment to a frame
 CENV_API void cenv_close(); // Close (delete) the environment (shutdown)
 
+// Handle to a single environment instance, many can live in one process
+typedef struct cenv_instance cenv_instance;
+
+// C ENV DEVELOPERS: IMPLEMENT THESE IN YOUR ENV TO SUPPORT MULTIPLE INSTANCES PER PROCESS (OPTIONAL)
+// CoinRun ignores render_mode and the seed argument of reset, reseed with the "seed" reset option instead
+// Making and closing instances must be safe to call from several threads at once (process-wide state is shared), calls on one instance are not
+CENV_API cenv_instance* cenv_make_instance(int32_t cenv_version, const char* render_mode, cenv_option* options, int32_t options_size); // Make an instance, NULL on error or if cenv_version != CENV_VERSION
+CENV_API int32_t cenv_reset_instance(cenv_instance* instance, int32_t seed, cenv_option* options, int32_t options_size); // Reset an instance
+CENV_API int32_t cenv_step_instance(cenv_instance* instance, cenv_key_value* actions, int32_t actions_size); // Step (update) an instance
+CENV_API int32_t cenv_render_instance(cenv_instance* instance); // Render an instance to a frame
+CENV_API void cenv_close_instance(cenv_instance* instance); // Close (delete) an instance
+
+// Make the env write observation index (as in the observations of reset/step data) into caller memory of value_buffer_size elements, NULL reverts to the env's own buffer
+CENV_API int32_t cenv_set_observation_buffer(cenv_instance* instance, int32_t index, void* buffer);
+
+// Per-instance equivalents of the data globals, valid until the instance is closed
+CENV_API cenv_make_data* cenv_get_make_data(cenv_instance* instance);
+CENV_API cenv_reset_data* cenv_get_reset_data(cenv_instance* instance);
+CENV_API cenv_step_data* cenv_get_step_data(cenv_instance* instance);
+CENV_API cenv_render_data* cenv_get_render_data(cenv_instance* instance);
+
+// Handle to a batch of instances that are stepped together
+typedef struct cenv_batch cenv_batch;
+
+// C ENV DEVELOPERS: IMPLEMENT THESE IN YOUR ENV TO SUPPORT BATCHED STEPPING (OPTIONAL)
+CENV_API cenv_batch* cenv_make_batch(int32_t cenv_version, int32_t num_instances, const char* render_mode, cenv_option* options, int32_t options_size); // Make a batch, instance i is seeded with the "seed" option + i
+CENV_API int32_t cenv_reset_batch(cenv_batch* batch, void* observations); // Reset all instances, observations are written contiguously (num_instances * observation size)
+CENV_API int32_t cenv_step_batch(cenv_batch* batch, const int32_t* actions, void* observations, float* rewards, bool* terminated, bool* truncated); // One action per instance, arrays are num_instances long. Finished instances are reset automatically
+CENV_API int32_t cenv_step_batch_async(cenv_batch* batch, const int32_t* actions, void* observations, float* rewards, bool* terminated, bool* truncated); // Like cenv_step_batch, but returns right away. Output arrays must stay valid until cenv_step_batch_wait
+CENV_API int32_t cenv_step_batch_wait(cenv_batch* batch); // Wait for the step started by cenv_step_batch_async, no other batch calls until then
+CENV_API int32_t cenv_get_batch_size(cenv_batch* batch); // Number of instances
+CENV_API cenv_instance* cenv_get_batch_instance(cenv_batch* batch, int32_t index); // Access a single instance (e.g. for spaces or rendering)
+CENV_API void cenv_close_batch(cenv_batch* batch); // Close (delete) the batch and its instances
+
+// C ENV DEVELOPERS: IMPLEMENT THESE IN YOUR ENV TO SUPPORT SNAPSHOTS (OPTIONAL)
+CENV_API int32_t cenv_get_state_instance(cenv_instance* instance, uint8_t* buffer, int32_t buffer_size); // Returns the snapshot size, writes it only if buffer_size is large enough (NULL, 0 to query the size)
+CENV_API int32_t cenv_set_state_instance(cenv_instance* instance, const uint8_t* buffer, int32_t buffer_size); // Restore a snapshot taken by the same build, the observation is rendered like after a reset
+CENV_API int32_t cenv_get_state(uint8_t* buffer, int32_t buffer_size); // Single instance equivalents
+CENV_API int32_t cenv_set_state(const uint8_t* buffer, int32_t buffer_size);
+
+// Handle to an in-process snapshot, cheaper than the byte form since data that is constant for an episode can be shared
+typedef struct cenv_state cenv_state;
+
+// C ENV DEVELOPERS: IMPLEMENT THESE IN YOUR ENV TO SUPPORT IN-PROCESS SNAPSHOTS (OPTIONAL)
+CENV_API cenv_state* cenv_make_state(); // Make an empty state, reusable for many saves
+CENV_API int32_t cenv_save_state_instance(cenv_instance* instance, cenv_state* state); // Overwrite state with a snapshot of the instance
+CENV_API int32_t cenv_load_state_instance(cenv_instance* instance, const cenv_state* state); // Restore into any instance made with the same options, the observation is rendered like after a reset
+CENV_API void cenv_close_state(cenv_state* state); // Close (delete) the state, instances never depend on it
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,7 +5,10 @@ import copy
 import sys
 import numpy as np
 from ctypes import *
+import os
 import struct
+from functools import partial
+from concurrent.futures import ThreadPoolExecutor
 
 from typing import (
     Any,
@@ -15,6 +18,8 @@ from typing import (
     Tuple
 )
 
+CENV_VERSION = 2
+
 # Types
 CENV_VALUE_TYPE_INT = 0
 CENV_VALUE_TYPE_FLOAT = 1
@@ -130,6 +135,18 @@ def _make_nd_array(c_pointer, shape, dtype=np.float32, order='C', own_data=True)
 
     return arr
 
+# Threads running CEnv.step_async, shared by all envs and made on first use. One per core is enough since the step
+# itself runs natively with the GIL released
+_step_executor = None
+
+def _get_step_executor() -> ThreadPoolExecutor:
+    global _step_executor
+
+    if _step_executor == None:
+        _step_executor = ThreadPoolExecutor(max_workers=os.cpu_count())
+
+    return _step_executor
+
 class CEnv(Env):
     metadata = {"render_modes": ["human", "single_rgb_array"]}
 
@@ -156,32 +173,114 @@ class CEnv(Env):
         self.lib.cenv_close.argtypes = []
         self.lib.cenv_close.restype = None
 
-        # Get pointers to globals
-        self.c_make_data = CGym_Make_Data.in_dll(self.lib, "make_data")
-        self.c_reset_data = CGym_Reset_Data.in_dll(self.lib, "reset_data")
-        self.c_step_data = CGym_Step_Data.in_dll(self.lib, "step_data")
-        self.c_render_data = CGym_Render_Data.in_dll(self.lib, "render_data")
+        c_render_mode = bytes("" if render_mode == None else render_mode, "ascii")
 
-        ret = 0
+        c_options = None
+        num_options = 0
 
-        if options == None:
-            ret = self.lib.cenv_make(bytes("" if render_mode == None else render_mode, "ascii"), None, c_int32(0))
-        else:
-            # Make environment
-            c_options = CGym_Option * len(options)
+        if options != None:
+            num_options = len(options)
+            c_options = (CGym_Option * num_options)()
 
-            for k, v in options.items():
-                c_options[i].name = k
+            for i, (k, v) in enumerate(options.items()):
+                c_options[i].name = bytes(k, "ascii")
 
                 value_type = CENV_PYTHON_TYPE_TO_VALUE_TYPE[type(v)]
 
                 c_options[i].value_type = c_int32(value_type)
-                c_options[i].value = CGym_Value(GYM_VALUE_TYPE_TO_CTYPE[value_type](v))
+                setattr(c_options[i].value, "i" if value_type == CENV_VALUE_TYPE_INT else "f", v)
 
-            ret = self.lib.cenv_make("" if render_mode == None else render_mode, c_options, c_int32(len(options)))
+        # Envs that support multiple instances per process are driven through a handle, others through the globals
+        self.instance = None
 
-        if ret != 0:
-            raise(Exception("Non-zero error code!"))
+        if hasattr(self.lib, "cenv_make_instance"):
+            self.lib.cenv_make_instance.argtypes = [c_int32, c_char_p, POINTER(CGym_Option), c_int32]
+            self.lib.cenv_make_instance.restype = c_void_p
+
+            self.lib.cenv_reset_instance.argtypes = [c_void_p, c_int32, POINTER(CGym_Option), c_int32]
+            self.lib.cenv_reset_instance.restype = c_int32
+
+            self.lib.cenv_step_instance.argtypes = [c_void_p, POINTER(CGym_Key_Value), c_int32]
+            self.lib.cenv_step_instance.restype = c_int32
+
+            self.lib.cenv_render_instance.argtypes = [c_void_p]
+            self.lib.cenv_render_instance.restype = c_int32
+
+            self.lib.cenv_close_instance.argtypes = [c_void_p]
+            self.lib.cenv_close_instance.restype = None
+
+            self.lib.cenv_get_make_data.argtypes = [c_void_p]
+            self.lib.cenv_get_make_data.restype = POINTER(CGym_Make_Data)
+
+            self.lib.cenv_get_reset_data.argtypes = [c_void_p]
+            self.lib.cenv_get_reset_data.restype = POINTER(CGym_Reset_Data)
+
+            self.lib.cenv_get_step_data.argtypes = [c_void_p]
+            self.lib.cenv_get_step_data.restype = POINTER(CGym_Step_Data)
+
+            self.lib.cenv_get_render_data.argtypes = [c_void_p]
+            self.lib.cenv_get_render_data.restype = POINTER(CGym_Render_Data)
+
+            self.instance = self.lib.cenv_make_instance(c_int32(CENV_VERSION), c_render_mode, c_options, c_int32(num_options))
+
+            if self.instance == None:
+                raise(Exception("Could not make instance (error or mismatched cenv version)!"))
+
+            # Get pointers to instance data
+            self.c_make_data = self.lib.cenv_get_make_data(self.instance).contents
+            self.c_reset_data = self.lib.cenv_get_reset_data(self.instance).contents
+            self.c_step_data = self.lib.cenv_get_step_data(self.instance).contents
+            self.c_render_data = self.lib.cenv_get_render_data(self.instance).contents
+
+            self.lib.cenv_set_observation_buffer.argtypes = [c_void_p, c_int32, c_void_p]
+            self.lib.cenv_set_observation_buffer.restype = c_int32
+
+            self._reset = partial(self.lib.cenv_reset_instance, self.instance)
+            self._step = partial(self.lib.cenv_step_instance, self.instance)
+            self._render = partial(self.lib.cenv_render_instance, self.instance)
+            self._close = partial(self.lib.cenv_close_instance, self.instance)
+
+            if hasattr(self.lib, "cenv_get_state_instance"):
+                self.lib.cenv_get_state_instance.argtypes = [c_void_p, c_void_p, c_int32]
+                self.lib.cenv_get_state_instance.restype = c_int32
+
+                self.lib.cenv_set_state_instance.argtypes = [c_void_p, c_char_p, c_int32]
+                self.lib.cenv_set_state_instance.restype = c_int32
+
+            if hasattr(self.lib, "cenv_make_state"):
+                self.lib.cenv_make_state.argtypes = []
+                self.lib.cenv_make_state.restype = c_void_p
+
+                self.lib.cenv_save_state_instance.argtypes = [c_void_p, c_void_p]
+                self.lib.cenv_save_state_instance.restype = c_int32
+
+                self.lib.cenv_load_state_instance.argtypes = [c_void_p, c_void_p]
+                self.lib.cenv_load_state_instance.restype = c_int32
+
+                self.lib.cenv_close_state.argtypes = [c_void_p]
+                self.lib.cenv_close_state.restype = None
+        else:
+            ret = self.lib.cenv_make(c_render_mode, c_options, c_int32(num_options))
+
+            if ret != 0:
+                raise(Exception("Non-zero error code!"))
+
+            # Get pointers to globals
+            self.c_make_data = CGym_Make_Data.in_dll(self.lib, "make_data")
+            self.c_reset_data = CGym_Reset_Data.in_dll(self.lib, "reset_data")
+            self.c_step_data = CGym_Step_Data.in_dll(self.lib, "step_data")
+            self.c_render_data = CGym_Render_Data.in_dll(self.lib, "render_data")
+
+            self._reset = self.lib.cenv_reset
+            self._step = self.lib.cenv_step
+            self._render = self.lib.cenv_render
+            self._close = self.lib.cenv_close
+
+        # Observations the env writes directly into numpy memory, by key. Only set through set_observation_buffer, others are copied per call
+        self.observation_buffers = {}
+
+        # Step started by step_async
+        self.pending = None
 
         self.observation_space = {}
 
@@ -219,6 +318,86 @@ class CEnv(Env):
 
             self.action_space[self.c_make_data.action_spaces[i].key.decode()] = space
 
+    def set_observation_buffer(self, key: str, buffer: np.ndarray):
+        """
+        Have the env write observation `key` straight into `buffer` (e.g. a view of a shared memory region), without copies.
+        The buffer is reused: step and reset return it, overwritten in place.
+        """
+        assert self.instance != None and self.pending == None
+        assert buffer.flags.c_contiguous and buffer.flags.writeable
+
+        for i in range(self.c_step_data.observations_size):
+            if self.c_step_data.observations[i].key.decode() != key:
+                continue
+
+            assert buffer.size == int(self.c_step_data.observations[i].value_buffer_size)
+            assert buffer.dtype == CENV_VALUE_TYPE_TO_NUMPY_DTYPE[int(self.c_step_data.observations[i].value_type)]
+
+            ret = self.lib.cenv_set_observation_buffer(self.instance, c_int32(i), buffer.ctypes.data)
+
+            if ret != 0:
+                raise(Exception("Non-zero error code!"))
+
+            # Keep it alive as long as the env writes into it
+            self.observation_buffers[key] = buffer
+
+            return
+
+        raise(Exception("Unknown observation key!"))
+
+    def get_state(self) -> bytes:
+        """
+        Snapshot of the env, restore it with set_state on this env or another one made with the same options.
+        """
+        assert self.instance != None and hasattr(self.lib, "cenv_get_state_instance")
+
+        size = self.lib.cenv_get_state_instance(self.instance, None, c_int32(0))
+
+        buffer = create_string_buffer(size)
+
+        self.lib.cenv_get_state_instance(self.instance, buffer, c_int32(size))
+
+        return buffer.raw
+
+    def set_state(self, state: bytes):
+        """
+        Restore a snapshot from get_state. Registered observation buffers hold the restored observation afterwards.
+        """
+        assert self.instance != None and hasattr(self.lib, "cenv_set_state_instance")
+
+        ret = self.lib.cenv_set_state_instance(self.instance, state, c_int32(len(state)))
+
+        if ret != 0:
+            raise(Exception("Non-zero error code!"))
+
+    def clone_state(self, state: Optional["CEnvState"] = None) -> "CEnvState":
+        """
+        In-process snapshot, restore it with restore_state on this env or another one made with the same options.
+        Level data is shared between the env and its clones, pass a previous state to reuse its memory as well.
+        """
+        assert self.instance != None and hasattr(self.lib, "cenv_make_state")
+
+        if state == None:
+            state = CEnvState(self.lib)
+
+        ret = self.lib.cenv_save_state_instance(self.instance, state.handle)
+
+        if ret != 0:
+            raise(Exception("Non-zero error code!"))
+
+        return state
+
+    def restore_state(self, state: "CEnvState"):
+        """
+        Restore a state from clone_state. Registered observation buffers hold the restored observation afterwards.
+        """
+        assert self.instance != None and hasattr(self.lib, "cenv_load_state_instance")
+
+        ret = self.lib.cenv_load_state_instance(self.instance, state.handle)
+
+        if ret != 0:
+            raise(Exception("Non-zero error code!"))
+
     def step(self, action: gym.core.ActType) -> Tuple[gym.core.ObsType, float, bool, bool, dict]:
         c_actions = None
         num_actions = 1
@@ -251,7 +430,7 @@ class CEnv(Env):
         else:
             raise(Exception("Unrecognized action type! Supported are: int, np.array, Dict[np.array]"))
             
-        ret = self.lib.cenv_step(c_actions, c_int32(num_actions))
+        ret = self._step(c_actions, c_int32(num_actions))
 
         if ret != 0:
             raise(Exception("Non-zero error code!"))
@@ -260,13 +439,21 @@ class CEnv(Env):
         observation = {}
 
         for i in range(self.c_step_data.observations_size):
+            key = self.c_step_data.observations[i].key.decode()
+
+            # Registered buffers were written in place
+            if key in self.observation_buffers:
+                observation[key] = self.observation_buffers[key]
+
+                continue
+
             value_type = int(self.c_step_data.observations[i].value_type)
             value_buffer_size = int(self.c_step_data.observations[i].value_buffer_size)
             c_buffer_p = self.c_step_data.observations[i].value_buffer.b
 
             arr = _make_nd_array(c_buffer_p, (value_buffer_size,), dtype=CENV_VALUE_TYPE_TO_NUMPY_DTYPE[value_type])
 
-            observation[self.c_step_data.observations[i].key.decode()] = arr
+            observation[key] = arr
         
         info = {}
 
@@ -285,6 +472,26 @@ class CEnv(Env):
 
         return (observation, reward, terminated, truncated, info)
 
+    def step_async(self, action: gym.core.ActType):
+        """
+        Start step(action) and return right away. ctypes releases the GIL during the native step, so the caller can do other work (e.g. inference) meanwhile.
+        Call step_wait for the result before any other call on this env.
+        Not available with registered observation buffers: the step would overwrite the observation the last step returned while it is still in use.
+        CVecEnv steps many envs on native threads and double buffers its outputs.
+        """
+        assert self.pending == None
+        assert len(self.observation_buffers) == 0, "step_async needs copied observations, use CVecEnv to step into caller-owned buffers"
+
+        self.pending = _get_step_executor().submit(self.step, action)
+
+    def step_wait(self) -> Tuple[gym.core.ObsType, float, bool, bool, dict]:
+        assert self.pending != None
+
+        pending = self.pending
+        self.pending = None
+
+        return pending.result()
+
     def reset(self, seed: Optional[int] = None, options: Optional[List[Any]] = None) -> Tuple[gym.core.ObsType, dict]:
         if seed == None:
             seed = 0
@@ -294,7 +501,7 @@ class CEnv(Env):
         if options != None:
             c_options = CGym_Option * len(options)
 
-        ret = self.lib.cenv_reset(c_int32(seed), c_options, c_int32(0 if options == None else len(options)))
+        ret = self._reset(c_int32(seed), c_options, c_int32(0 if options == None else len(options)))
         
         if ret != 0:
             raise(Exception("Non-zero error code!"))
@@ -303,13 +510,21 @@ class CEnv(Env):
         observation = {}
 
         for i in range(self.c_reset_data.observations_size):
+            key = self.c_reset_data.observations[i].key.decode()
+
+            # Registered buffers were written in place
+            if key in self.observation_buffers:
+                observation[key] = self.observation_buffers[key]
+
+                continue
+
             value_type = int(self.c_reset_data.observations[i].value_type)
             value_buffer_size = int(self.c_reset_data.observations[i].value_buffer_size)
             c_buffer_p = self.c_reset_data.observations[i].value_buffer.b
 
             arr = _make_nd_array(c_buffer_p, (value_buffer_size,), dtype=CENV_VALUE_TYPE_TO_NUMPY_DTYPE[value_type])
 
-            observation[self.c_reset_data.observations[i].key.decode()] = arr
+            observation[key] = arr
         
         info = {}
 
@@ -325,7 +540,7 @@ class CEnv(Env):
         return (observation, info)
 
     def render(self) -> gym.core.RenderFrame:
-        self.lib.cenv_render()
+        self._render()
 
         value_type = self.c_render_data.value_type
         value_buffer_size = self.c_render_data.value_buffer_height * self.c_render_data.value_buffer_width * self.c_render_data.value_buffer_channels
@@ -336,4 +551,206 @@ class CEnv(Env):
         return arr.reshape(self.c_render_data.value_buffer_height, self.c_render_data.value_buffer_width, self.c_render_data.value_buffer_channels)
 
     def close(self):
-        self.lib.cenv_close()
+        if self.pending != None:
+            self.step_wait()
+
+        self._close()
+
+class CEnvState:
+    """
+    Handle to an in-process env snapshot (see CEnv.clone_state), freed with the object.
+    """
+    def __init__(self, lib):
+        self.lib = lib
+        self.handle = self.lib.cenv_make_state()
+
+    def __del__(self):
+        if self.handle != None:
+            self.lib.cenv_close_state(self.handle)
+
+            self.handle = None
+
+class CVecEnv:
+    """
+    Steps many instances of a cenv with a single call per batch.
+    Requires the env to implement the batch entry points. Finished instances are reset automatically.
+    Outputs are double buffered: returned arrays stay valid until the second next call to step or reset.
+    step_async/step_wait run the step on native threads, so the caller can do other work (e.g. inference) meanwhile.
+    Pass two (num_envs, observation size) arrays as observation_buffers (e.g. views of shared memory) to have observations written there directly.
+    """
+    def __init__(self, lib_file_path: str, num_envs: int, render_mode: Optional[str] = None, options: Optional[Dict[str, Any]] = None, observation_buffers: Optional[List[np.ndarray]] = None):
+        self.lib = CDLL(lib_file_path)
+
+        self.lib.cenv_make_batch.argtypes = [c_int32, c_int32, c_char_p, POINTER(CGym_Option), c_int32]
+        self.lib.cenv_make_batch.restype = c_void_p
+
+        self.lib.cenv_reset_batch.argtypes = [c_void_p, c_void_p]
+        self.lib.cenv_reset_batch.restype = c_int32
+
+        self.lib.cenv_step_batch.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p, c_void_p, c_void_p]
+        self.lib.cenv_step_batch.restype = c_int32
+
+        self.lib.cenv_step_batch_async.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p, c_void_p, c_void_p]
+        self.lib.cenv_step_batch_async.restype = c_int32
+
+        self.lib.cenv_step_batch_wait.argtypes = [c_void_p]
+        self.lib.cenv_step_batch_wait.restype = c_int32
+
+        self.lib.cenv_get_batch_instance.argtypes = [c_void_p, c_int32]
+        self.lib.cenv_get_batch_instance.restype = c_void_p
+
+        self.lib.cenv_get_make_data.argtypes = [c_void_p]
+        self.lib.cenv_get_make_data.restype = POINTER(CGym_Make_Data)
+
+        self.lib.cenv_get_step_data.argtypes = [c_void_p]
+        self.lib.cenv_get_step_data.restype = POINTER(CGym_Step_Data)
+
+        self.lib.cenv_render_instance.argtypes = [c_void_p]
+        self.lib.cenv_render_instance.restype = c_int32
+
+        self.lib.cenv_get_render_data.argtypes = [c_void_p]
+        self.lib.cenv_get_render_data.restype = POINTER(CGym_Render_Data)
+
+        self.lib.cenv_close_batch.argtypes = [c_void_p]
+        self.lib.cenv_close_batch.restype = None
+
+        c_options = None
+        num_options = 0
+
+        if options != None:
+            num_options = len(options)
+            c_options = (CGym_Option * num_options)()
+
+            for i, (k, v) in enumerate(options.items()):
+                c_options[i].name = bytes(k, "ascii")
+
+                value_type = CENV_PYTHON_TYPE_TO_VALUE_TYPE[type(v)]
+
+                c_options[i].value_type = c_int32(value_type)
+                setattr(c_options[i].value, "i" if value_type == CENV_VALUE_TYPE_INT else "f", v)
+
+        self.num_envs = num_envs
+
+        self.batch = self.lib.cenv_make_batch(c_int32(CENV_VERSION), c_int32(num_envs), bytes("" if render_mode == None else render_mode, "ascii"), c_options, c_int32(num_options))
+
+        if self.batch == None:
+            raise(Exception("Could not make batch (error or mismatched cenv version)!"))
+
+        # Spaces and observation layout come from the first instance (all are identical)
+        instance = self.lib.cenv_get_batch_instance(self.batch, c_int32(0))
+
+        c_make_data = self.lib.cenv_get_make_data(instance).contents
+        c_step_data = self.lib.cenv_get_step_data(instance).contents
+
+        self.observation_key = c_step_data.observations[0].key.decode()
+        observation_dtype = CENV_VALUE_TYPE_TO_NUMPY_DTYPE[int(c_step_data.observations[0].value_type)]
+        observation_size = int(c_step_data.observations[0].value_buffer_size)
+
+        self.action_space = {}
+
+        for i in range(c_make_data.action_spaces_size):
+            value_type = int(c_make_data.action_spaces[i].value_type)
+            value_buffer_size = int(c_make_data.action_spaces[i].value_buffer_size)
+
+            arr = _make_nd_array(c_make_data.action_spaces[i].value_buffer.b, (value_buffer_size,), dtype=CENV_VALUE_TYPE_TO_NUMPY_DTYPE[value_type])
+
+            self.action_space[c_make_data.action_spaces[i].key.decode()] = gym.spaces.MultiDiscrete(arr)
+
+        # Two sets of output arrays, filled in place by the env
+        if observation_buffers == None:
+            self.observations = [np.zeros((num_envs, observation_size), dtype=observation_dtype) for _ in range(2)]
+        else:
+            assert len(observation_buffers) == 2
+
+            for buffer in observation_buffers:
+                assert buffer.shape == (num_envs, observation_size) and buffer.dtype == observation_dtype and buffer.flags.c_contiguous
+
+            self.observations = list(observation_buffers)
+
+        self.rewards = [np.zeros(num_envs, dtype=np.float32) for _ in range(2)]
+        self.terminated = [np.zeros(num_envs, dtype=np.bool_) for _ in range(2)]
+        self.truncated = [np.zeros(num_envs, dtype=np.bool_) for _ in range(2)]
+
+        self.buffer_index = 0
+        self.waiting = False
+
+    def _next_buffer(self) -> int:
+        self.buffer_index = 1 - self.buffer_index
+
+        return self.buffer_index
+
+    def _results(self, b: int) -> Tuple[Dict[str, np.ndarray], np.ndarray, np.ndarray, np.ndarray, dict]:
+        return ({ self.observation_key: self.observations[b] }, self.rewards[b], self.terminated[b], self.truncated[b], {})
+
+    def reset(self) -> Tuple[Dict[str, np.ndarray], dict]:
+        b = self._next_buffer()
+
+        ret = self.lib.cenv_reset_batch(self.batch, self.observations[b].ctypes.data)
+
+        if ret != 0:
+            raise(Exception("Non-zero error code!"))
+
+        return ({ self.observation_key: self.observations[b] }, {})
+
+    def step(self, actions: np.ndarray) -> Tuple[Dict[str, np.ndarray], np.ndarray, np.ndarray, np.ndarray, dict]:
+        actions = np.ascontiguousarray(actions, dtype=np.int32)
+
+        assert actions.shape == (self.num_envs,)
+
+        b = self._next_buffer()
+
+        ret = self.lib.cenv_step_batch(self.batch, actions.ctypes.data, self.observations[b].ctypes.data, self.rewards[b].ctypes.data, self.terminated[b].ctypes.data, self.truncated[b].ctypes.data)
+
+        if ret != 0:
+            raise(Exception("Non-zero error code!"))
+
+        return self._results(b)
+
+    def step_async(self, actions: np.ndarray):
+        actions = np.ascontiguousarray(actions, dtype=np.int32)
+
+        assert actions.shape == (self.num_envs,)
+        assert not self.waiting
+
+        b = self._next_buffer()
+
+        ret = self.lib.cenv_step_batch_async(self.batch, actions.ctypes.data, self.observations[b].ctypes.data, self.rewards[b].ctypes.data, self.terminated[b].ctypes.data, self.truncated[b].ctypes.data)
+
+        if ret != 0:
+            raise(Exception("Non-zero error code!"))
+
+        self.waiting = True
+
+    def step_wait(self) -> Tuple[Dict[str, np.ndarray], np.ndarray, np.ndarray, np.ndarray, dict]:
+        assert self.waiting
+
+        ret = self.lib.cenv_step_batch_wait(self.batch)
+
+        self.waiting = False
+
+        if ret != 0:
+            raise(Exception("Non-zero error code!"))
+
+        return self._results(self.buffer_index)
+
+    def render(self, index: int = 0) -> gym.core.RenderFrame:
+        # The pool may be stepping the instance
+        assert not self.waiting, "call step_wait before render"
+
+        instance = self.lib.cenv_get_batch_instance(self.batch, c_int32(index))
+
+        self.lib.cenv_render_instance(instance)
+
+        c_render_data = self.lib.cenv_get_render_data(instance).contents
+
+        value_buffer_size = c_render_data.value_buffer_height * c_render_data.value_buffer_width * c_render_data.value_buffer_channels
+
+        arr = _make_nd_array(c_render_data.value_buffer.b, (value_buffer_size,), dtype=CENV_VALUE_TYPE_TO_NUMPY_DTYPE[c_render_data.value_type])
+
+        return arr.reshape(c_render_data.value_buffer_height, c_render_data.value_buffer_width, c_render_data.value_buffer_channels)
+
+    def close(self):
+        if self.waiting:
+            self.step_wait()
+
+        self.lib.cenv_close_batch(self.batch)
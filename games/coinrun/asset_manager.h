@@ -2,36 +2,56 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 #include <unordered_map>
+#include <assert.h>
 
+// Assets get ids in load order, components refer to them by id so they stay plain data (and can be snapshotted).
+// Loading happens in the same order in every process, so ids match across processes running the same build
 template<typename T>
 class Asset_Manager {
 private:
-    std::unordered_map<std::string, std::shared_ptr<T>> assets;
+    std::unordered_map<std::string, int> ids;
+    std::vector<std::unique_ptr<T>> assets; // Indexed by id
 
 public:
-    T &get(const std::string &name) {
-        if (assets.find(name) == assets.end()) {
-            assets[name] = std::make_shared<T>();
-
-            try {
-                assets[name]->load(name);
-            }
-            catch (std::exception e) {
-                throw e;
-            }
+    // Only loading modifies the manager, looking up loaded assets is safe from multiple threads
+    int get_id(const std::string &name) {
+        auto it = ids.find(name);
+
+        if (it == ids.end()) {
+            auto asset = std::make_unique<T>();
+
+            asset->load(name); // Nothing is registered if this throws
+
+            assets.push_back(std::move(asset));
+
+            it = ids.emplace(name, assets.size() - 1).first;
         }
 
-        return *assets[name];
+        return it->second;
     }
 
-    bool exists(const std::string &name) const {
-        return assets.find(name) != assets.end();
+    T &get(const std::string &name) {
+        return *assets[get_id(name)];
     }
 
-    void remove(const std::string &name) {
-        assert(exists(name));
+    T &get_by_id(int id) {
+        assert(id >= 0 && id < assets.size());
+
+        return *assets[id];
+    }
+
+    int size() const {
+        return assets.size();
+    }
+
+    bool exists(const std::string &name) const {
+        return ids.find(name) != ids.end();
+    }
 
-        assets.erase(assets.find(name));
+    void clear() {
+        ids.clear();
+        assets.clear();
     }
 };
@@ -2,9 +2,18 @@
 
 #include <cmath>
 #include <iostream>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+
+#include <SDL2/SDL_image.h>
 
 #include "tilemap.h"
+#include "level_pool.h"
+#include "level_pack.h"
 #include "common_systems.h"
+#include "thread_pool.h"
 
 const int version = 100;
 const bool show_log = false;
@@ -17,9 +26,6 @@ cenv_reset_data reset_data;
 cenv_step_data step_data;
 cenv_render_data render_data;
 
-// Shared value between different datas (optional)
-cenv_key_value observation;
-
 // ---------------------- Game ----------------------
 
 const int obs_width = 64;
@@ -31,30 +37,10 @@ const int window_height = 800;
 
 const float game_zoom = 0.35f; // Base game zoom level
 
-std::mt19937 rng;
-
-SDL_Surface* window_target; // Main render window
-SDL_Surface* obs_target; // Observation target
-SDL_Renderer* window_renderer;
-SDL_Renderer* obs_renderer;
-
-// Masking for SDL surfaces
-uint32_t rmask, gmask, bmask, amask;
+const int layer_chunk_size = 64; // Side of the baked level layer chunks, in obs pixels
 
 float dt = 1.0f / 20.0f; // 20 fps
 
-// Systems
-std::shared_ptr<System_Sprite_Render> sprite_render;
-std::shared_ptr<System_Tilemap> tilemap;
-std::shared_ptr<System_Mob_AI> mob_ai;
-std::shared_ptr<System_Hazard> hazard;
-std::shared_ptr<System_Goal> goal;
-std::shared_ptr<System_Agent> agent;
-std::shared_ptr<System_Particles> particles;
-
-System_Tilemap::Config tilemap_config;
-int current_map_theme = 0;
-
 // Big list of different background images
 std::vector<std::string> background_names {
     "assets/platform_backgrounds/alien_bg.png",
@@ -108,25 +94,221 @@ std::vector<std::string> background_names {
     "assets/platform_backgrounds_2/candy4.png"
 };
 
-std::vector<Asset_Texture> background_textures;
+// ---------------------- Shared ----------------------
+
+// Assets are shared by all instances in the process, textures are immutable once loaded
+int num_instances = 0;
+
+// Making and closing instances loads and frees the shared assets, callers may do that from several threads at once
+std::mutex instances_mutex;
+
+std::vector<Asset_Texture*> background_textures;
+
+// ---------------------- Instance ----------------------
+
+// Everything owned by a single environment
+struct cenv_instance {
+    // CEnv data
+    cenv_make_data make_data;
+    cenv_reset_data reset_data;
+    cenv_step_data step_data;
+    cenv_render_data render_data;
+
+    // Shared value between different datas (optional)
+    cenv_key_value observation;
+
+    // Owned observation buffer, used unless the caller registers its own
+    uint8_t* observation_storage = nullptr;
+
+    // Observations as three planes (CHW) instead of interleaved RGB (HWC)
+    bool channels_first = false;
+    std::vector<uint8_t> interleaved_frame; // Render target for channels first observations
+
+    // Updates per step with the same action (action repeat), only the last one is rendered
+    int frame_skip = 1;
+
+    // When false steps and resets leave the observation buffer untouched, for reward-only rollouts
+    bool render_observations = true;
+
+    // Game
+    World world;
+    Renderer renderer;
+
+    // Pregenerated levels, outlives the pool reading from it
+    Level_Pack level_pack;
+
+    // Levels generated ahead of resets, and the one being played
+    Level_Pool levels;
+    Level_Descriptor level;
+
+    // Pregenerating only pays off with a spare core for the pool's thread, otherwise the hand-off costs more
+    // than generating a level
+    Level_Pool::Settings level_settings;
+
+    // Systems
+    std::shared_ptr<System_Sprite_Render> sprite_render;
+    std::shared_ptr<System_Tilemap> tilemap;
+    std::shared_ptr<System_Mob_AI> mob_ai;
+    std::shared_ptr<System_Hazard> hazard;
+    std::shared_ptr<System_Goal> goal;
+    std::shared_ptr<System_Agent> agent;
+    std::shared_ptr<System_Particles> particles;
+
+    int current_map_theme = 0;
+
+    int current_background_index = 0;
+    float current_background_offset_x = 0.0f;
+
+    int current_agent_theme = 0;
+
+    // Background and tiles pre-composited at obs resolution in square chunks. A chunk is baked
+    // the first time it is visible after a reset, episodes rarely see more than a few of them
+    std::vector<uint8_t> level_layer_pixels;
+    std::vector<bool> level_layer_baked;
+    int level_layer_chunks_x = 0;
+    int level_layer_chunks_y = 0;
+    Vector2 level_layer_position{ 0.0f, 0.0f }; // Top left corner in the world
+};
+
+// Instances that are stepped together
+struct cenv_batch {
+    std::vector<cenv_instance*> instances;
 
-int current_background_index = 0;
-float current_background_offset_x = 0.0f;
+    Thread_Pool pool;
 
-int current_agent_theme = 0;
+    // Copy of the actions for the step in flight (cenv_step_batch_async)
+    std::vector<int32_t> async_actions;
+
+    // Arguments of the current reset or step. The tasks read them from here and only capture the batch, so they fit
+    // std::function's inline storage and are built once instead of allocating every call
+    const int32_t* actions = nullptr;
+    void* observations = nullptr;
+    float* rewards = nullptr;
+    bool* terminated = nullptr;
+    bool* truncated = nullptr;
+
+    std::function<void(int)> reset_task;
+    std::function<void(int)> step_task;
+};
+
+// Instance backing the single-environment entry points and globals
+cenv_instance* default_instance = nullptr;
 
 // Forward declarations
-void render_game(bool is_obs);
-void reset();
+void bind(cenv_instance* instance);
+void render_game(cenv_instance* instance, uint8_t* pixels, int width, int height);
+void render_background(cenv_instance* instance);
+void render_level_layer(cenv_instance* instance);
+void reset(cenv_instance* instance);
+void render_observation(cenv_instance* instance, uint8_t* observation);
+void step(cenv_instance* instance, int action, int frame_skip);
+void reset_batch_instance(cenv_batch* batch, int i);
+void step_batch_instance(cenv_batch* batch, int i);
+void init_shared();
+void close_shared();
 
 int32_t cenv_get_env_version() {
     return version;
 }
 
+// ---------------------- Single Instance ----------------------
+
+// Mirror the default instance into the cenv globals
+void sync_globals() {
+    make_data = default_instance->make_data;
+    reset_data = default_instance->reset_data;
+    step_data = default_instance->step_data;
+    render_data = default_instance->render_data;
+}
+
 int32_t cenv_make(const char* render_mode, cenv_option* options, int32_t options_size) {
+    default_instance = cenv_make_instance(CENV_VERSION, render_mode, options, options_size);
+
+    if (default_instance == nullptr)
+        return 1;
+
+    sync_globals();
+
+    return 0; // No error
+}
+
+int32_t cenv_reset(int32_t seed, cenv_option* options, int32_t options_size) {
+    int32_t ret = cenv_reset_instance(default_instance, seed, options, options_size);
+
+    sync_globals();
+
+    return ret;
+}
+
+int32_t cenv_step(cenv_key_value* actions, int32_t actions_size) {
+    int32_t ret = cenv_step_instance(default_instance, actions, actions_size);
+
+    sync_globals();
+
+    return ret;
+}
+
+int32_t cenv_render() {
+    int32_t ret = cenv_render_instance(default_instance);
+
+    sync_globals();
+
+    return ret;
+}
+
+int32_t cenv_get_state(uint8_t* buffer, int32_t buffer_size) {
+    return cenv_get_state_instance(default_instance, buffer, buffer_size);
+}
+
+int32_t cenv_set_state(const uint8_t* buffer, int32_t buffer_size) {
+    int32_t ret = cenv_set_state_instance(default_instance, buffer, buffer_size);
+
+    sync_globals();
+
+    return ret;
+}
+
+void cenv_close() {
+    cenv_close_instance(default_instance);
+
+    default_instance = nullptr;
+}
+
+// ---------------------- Instances ----------------------
+
+cenv_instance* cenv_make_instance(int32_t cenv_version, const char* render_mode, cenv_option* options, int32_t options_size) {
+    if (cenv_version != CENV_VERSION)
+        return nullptr;
+
+    (void)render_mode; // Frames are always rendered into the render data, whatever the mode
+
+    std::lock_guard<std::mutex> lock(instances_mutex);
+
+    cenv_instance* instance = new cenv_instance();
+
+    // Levels come from a pack if one is given, no option type carries a path
+    const char* level_pack_path = std::getenv("COINRUN_LEVEL_PACK");
+
+    if (level_pack_path != nullptr && level_pack_path[0] != '\0') {
+        if (instance->level_pack.open(level_pack_path) != 0) {
+            delete instance;
+
+            return nullptr;
+        }
+
+        // Play the packed levels unless the options pick others
+        instance->level_settings.num_levels = instance->level_pack.get_num_levels();
+        instance->level_settings.start_level = instance->level_pack.get_start_level();
+        instance->level_settings.config = instance->level_pack.get_config();
+        instance->level_settings.pack = &instance->level_pack;
+        instance->level_settings.cache_size = 0; // The pack already holds them
+    }
+
     // ---------------------- CEnv Interface ----------------------
     
     // Allocate make data
+    cenv_make_data &make_data = instance->make_data;
+
     make_data.observation_spaces_size = 1;
     make_data.observation_spaces = (cenv_key_value*)malloc(sizeof(cenv_key_value));
 
@@ -151,18 +333,25 @@ int32_t cenv_make(const char* render_mode, cenv_option* options, int32_t options
     make_data.action_spaces[0].value_buffer.i[0] = num_actions;
 
     // Allocate observations once and re-use (doesn't resize dynamically)
+    cenv_key_value &observation = instance->observation;
+
     observation.key = "screen";
     observation.value_type = CENV_VALUE_TYPE_BYTE;
     observation.value_buffer_size = obs_width * obs_height * 3;
-    observation.value_buffer.b = (uint8_t*)malloc(obs_width * obs_height * 3 * sizeof(uint8_t));
+    instance->observation_storage = (uint8_t*)malloc(obs_width * obs_height * 3 * sizeof(uint8_t));
+    observation.value_buffer.b = instance->observation_storage;
 
     // Reset data
+    cenv_reset_data &reset_data = instance->reset_data;
+
     reset_data.observations_size = 1;
     reset_data.observations = &observation;
     reset_data.infos_size = 0;
     reset_data.infos = NULL;
 
     // Step data
+    cenv_step_data &step_data = instance->step_data;
+
     step_data.observations_size = 1;
     step_data.observations = &observation;
     step_data.reward.f = 0.0f;
@@ -172,6 +361,8 @@ int32_t cenv_make(const char* render_mode, cenv_option* options, int32_t options
     step_data.infos = NULL;
 
     // Frame
+    cenv_render_data &render_data = instance->render_data;
+
     render_data.value_type = CENV_VALUE_TYPE_BYTE;
     render_data.value_buffer_height = window_height;
     render_data.value_buffer_width = window_width;
@@ -189,112 +380,158 @@ int32_t cenv_make(const char* render_mode, cenv_option* options, int32_t options
 
             seed = options[i].value.i;
         }
+        else if (name == "channels_first") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            instance->channels_first = options[i].value.i != 0;
+        }
+        else if (name == "frame_skip") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            instance->frame_skip = std::max(1, options[i].value.i);
+        }
+        else if (name == "render_observations") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            instance->render_observations = options[i].value.i != 0;
+        }
+        else if (name == "pregenerate_levels") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            instance->level_settings.pregenerate = std::max(0, options[i].value.i);
+        }
+        else if (name == "num_levels") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            instance->level_settings.num_levels = std::max(0, options[i].value.i);
+        }
+        else if (name == "start_level") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            instance->level_settings.start_level = options[i].value.i;
+        }
+        else if (name == "level_cache_size") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            instance->level_settings.cache_size = std::max(0, options[i].value.i);
+        }
     }
 
+    if (instance->channels_first)
+        instance->interleaved_frame.resize(obs_width * obs_height * 3);
+
     // ---------------------- Game ----------------------
 
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-    rmask = 0xff000000;
-    gmask = 0x00ff0000;
-    bmask = 0x0000ff00;
-    amask = 0x000000ff;
-#else
-    rmask = 0x000000ff;
-    gmask = 0x0000ff00;
-    bmask = 0x00ff0000;
-    amask = 0xff000000;
-#endif
+    if (num_instances == 0)
+        init_shared();
 
-    SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
+    num_instances++;
 
-    SDL_Init(SDL_INIT_VIDEO);
+    bind(instance);
 
-    IMG_Init(IMG_INIT_PNG);
+    // Load backgrounds once
+    if (background_textures.empty()) {
+        background_textures.resize(background_names.size());
+
+        for (int i = 0; i < background_names.size(); i++) {
+            background_textures[i] = &manager_texture.get(background_names[i]);
 
-    window_target = SDL_CreateRGBSurface(0, window_width, window_height, 32, rmask, gmask, bmask, amask);
-    obs_target = SDL_CreateRGBSurface(0, obs_width, obs_height, 32, rmask, gmask, bmask, amask);
+            // Backgrounds always span the 64 unit high world, pre-filter them to the obs size
+            float obs_size = 64.0f * game_zoom * unit_to_pixels;
 
-    window_renderer = SDL_CreateSoftwareRenderer(window_target);
-    obs_renderer = SDL_CreateSoftwareRenderer(obs_target);
+            background_textures[i]->add_level(std::round(obs_size * background_textures[i]->width / background_textures[i]->height), std::round(obs_size));
+        }
+    }
 
-    gr.window_renderer = window_renderer;
-    gr.obs_renderer = obs_renderer;
+    // Start generating levels
+    instance->levels.init(instance->level_settings, seed);
 
-    // Seed RNG
-    rng.seed(seed);
+    World &world = instance->world;
 
     // Register components
-    c.register_component<Component_Transform>();
-    c.register_component<Component_Collision>();
-    c.register_component<Component_Dynamics>();
-    c.register_component<Component_Sprite>();
-    c.register_component<Component_Animation>();
-    c.register_component<Component_Hazard>();
-    c.register_component<Component_Goal>();
-    c.register_component<Component_Mob_AI>();
-    c.register_component<Component_Agent>(); // Player
-    c.register_component<Component_Particles>();
+    world.register_component<Component_Transform>();
+    world.register_component<Component_Collision>();
+    world.register_component<Component_Dynamics>();
+    world.register_component<Component_Sprite>();
+    world.register_component<Component_Animation>();
+    world.register_component<Component_Hazard>();
+    world.register_component<Component_Goal>();
+    world.register_component<Component_Mob_AI>();
+    world.register_component<Component_Agent>(); // Player
+    world.register_component<Component_Particles>();
 
     // Sprite rendering system
-    sprite_render = c.register_system<System_Sprite_Render>();
+    instance->sprite_render = world.register_system<System_Sprite_Render>();
     Signature sprite_render_signature;
-    sprite_render_signature.set(c.get_component_type<Component_Sprite>()); // Operate only on sprites
-    c.set_system_signature<System_Sprite_Render>(sprite_render_signature);
+    sprite_render_signature.set(world.get_component_type<Component_Sprite>()); // Operate only on sprites
+    world.set_system_signature<System_Sprite_Render>(sprite_render_signature);
+
+    instance->sprite_render->init();
 
     // Tile map setup
-    tilemap = c.register_system<System_Tilemap>();
+    instance->tilemap = world.register_system<System_Tilemap>();
     Signature tilemap_signature{ 0 }; // Operates on nothing
-    c.set_system_signature<System_Tilemap>(tilemap_signature);
+    world.set_system_signature<System_Tilemap>(tilemap_signature);
 
-    tilemap->init();
+    instance->tilemap->init();
 
     // Mob AI setup
-    mob_ai = c.register_system<System_Mob_AI>();
+    instance->mob_ai = world.register_system<System_Mob_AI>();
     Signature mob_ai_signature;
-    mob_ai_signature.set(c.get_component_type<Component_Mob_AI>()); // Operate only on mobs
-    c.set_system_signature<System_Mob_AI>(mob_ai_signature);
+    mob_ai_signature.set(world.get_component_type<Component_Mob_AI>()); // Operate only on mobs
+    world.set_system_signature<System_Mob_AI>(mob_ai_signature);
+
+    instance->mob_ai->tilemap = instance->tilemap.get();
 
     // Hazard system setup
-    hazard = c.register_system<System_Hazard>();
+    instance->hazard = world.register_system<System_Hazard>();
     Signature hazard_signature;
-    hazard_signature.set(c.get_component_type<Component_Hazard>()); // Operate only on hazards
-    c.set_system_signature<System_Hazard>(hazard_signature);
+    hazard_signature.set(world.get_component_type<Component_Hazard>()); // Operate only on hazards
+    world.set_system_signature<System_Hazard>(hazard_signature);
+
+    // Keep hazard transforms and collisions packed together, the broadphase is built from them on reset
+    Signature hazard_group_signature = hazard_signature;
+    hazard_group_signature.set(world.get_component_type<Component_Transform>());
+    hazard_group_signature.set(world.get_component_type<Component_Collision>());
+    instance->hazard->group = world.create_group<Component_Transform, Component_Collision>(hazard_group_signature);
+
+    instance->mob_ai->hazard = instance->hazard.get();
 
     // Goal system setup
-    goal = c.register_system<System_Goal>();
+    instance->goal = world.register_system<System_Goal>();
     Signature goal_signature;
-    goal_signature.set(c.get_component_type<Component_Goal>()); // Operate only on goals
-    c.set_system_signature<System_Goal>(goal_signature);
+    goal_signature.set(world.get_component_type<Component_Goal>()); // Operate only on goals
+    world.set_system_signature<System_Goal>(goal_signature);
 
     // Agent system setup
-    agent = c.register_system<System_Agent>();
+    instance->agent = world.register_system<System_Agent>();
     Signature agent_signature;
-    agent_signature.set(c.get_component_type<Component_Agent>()); // Operate only on mobs
-    c.set_system_signature<System_Agent>(agent_signature);
+    agent_signature.set(world.get_component_type<Component_Agent>()); // Operate only on mobs
+    world.set_system_signature<System_Agent>(agent_signature);
+
+    instance->agent->tilemap = instance->tilemap.get();
+    instance->agent->hazard = instance->hazard.get();
+    instance->agent->goal = instance->goal.get();
 
-    agent->init();
+    instance->agent->init();
 
     // Particle system setup
-    particles = c.register_system<System_Particles>();
+    instance->particles = world.register_system<System_Particles>();
     Signature particles_signature;
-    particles_signature.set(c.get_component_type<Component_Particles>()); // Operate only on particles
-    c.set_system_signature<System_Particles>(particles_signature);
+    particles_signature.set(world.get_component_type<Component_Particles>()); // Operate only on particles
+    world.set_system_signature<System_Particles>(particles_signature);
 
-    particles->init();
-
-    // Load backgrounds
-    background_textures.resize(background_names.size());
-
-    for (int i = 0; i < background_names.size(); i++)
-        background_textures[i].load(background_names[i]);
+    instance->particles->init();
 
     // Reset spawns entities while generating map
-    reset();
+    reset(instance);
 
-    return 0; // No error
+    return instance;
 }
 
-int32_t cenv_reset(int32_t seed, cenv_option* options, int32_t options_size) {
+int32_t cenv_reset_instance(cenv_instance* instance, int32_t seed, cenv_option* options, int32_t options_size) {
+    (void)seed; // The Python wrapper passes 0 for no seed, so levels are only reseeded by the "seed" option
+
     // Parse options
     for (int i = 0; i < options_size; i++) {
         std::string name(options[i].name);
@@ -302,50 +539,23 @@ int32_t cenv_reset(int32_t seed, cenv_option* options, int32_t options_size) {
         if (name == "seed") {
             assert(options[i].value_type == CENV_VALUE_TYPE_INT);
 
-            rng.seed(options[i].value.i);
+            instance->levels.seed(options[i].value.i);
         }
     }
 
-    reset();
+    bind(instance);
 
-    render_game(true);
+    reset(instance);
 
-    // Grab observation
-    SDL_LockSurface(obs_target);
-
-    uint8_t* pixels = (uint8_t*)obs_target->pixels;
-
-    for (int x = 0; x < obs_width; x++)
-        for (int y = 0; y < obs_height; y++) {
-            observation.value_buffer.b[0 + 3 * (y + obs_height * x)] = pixels[0 + 4 * (y + obs_height * x)];
-            observation.value_buffer.b[1 + 3 * (y + obs_height * x)] = pixels[1 + 4 * (y + obs_height * x)];
-            observation.value_buffer.b[2 + 3 * (y + obs_height * x)] = pixels[2 + 4 * (y + obs_height * x)];
-        }
-
-    SDL_UnlockSurface(obs_target);
+    if (instance->render_observations)
+        render_observation(instance, instance->observation.value_buffer.b);
 
     return 0; // No error
 }
 
-int32_t cenv_step(cenv_key_value* actions, int32_t actions_size) {
-    // Render and grab pixels
-    render_game(true);
-
-    // Grab observation
-    SDL_LockSurface(obs_target);
-
-    uint8_t* pixels = (uint8_t*)obs_target->pixels;
-
-    for (int x = 0; x < obs_width; x++)
-        for (int y = 0; y < obs_height; y++) {
-            observation.value_buffer.b[0 + 3 * (y + obs_height * x)] = pixels[0 + 4 * (y + obs_height * x)];
-            observation.value_buffer.b[1 + 3 * (y + obs_height * x)] = pixels[1 + 4 * (y + obs_height * x)];
-            observation.value_buffer.b[2 + 3 * (y + obs_height * x)] = pixels[2 + 4 * (y + obs_height * x)];
-        }
-
-    SDL_UnlockSurface(obs_target);
-
+int32_t cenv_step_instance(cenv_instance* instance, cenv_key_value* actions, int32_t actions_size) {
     int action = 0;
+    int frame_skip = instance->frame_skip;
 
     // Parse actions
     for (int i = 0; i < actions_size; i++) {
@@ -357,46 +567,41 @@ int32_t cenv_step(cenv_key_value* actions, int32_t actions_size) {
 
             action = actions[i].value_buffer.i[0];
         }
+        else if (key == "frame_skip") {
+            // Overrides the frame_skip option for this step only
+            assert(actions[i].value_type == CENV_VALUE_TYPE_INT);
+            assert(actions[i].value_buffer_size == 1);
+
+            frame_skip = std::max(1, actions[i].value_buffer.i[0]);
+        }
     }
 
-    // Update systems
-    mob_ai->update(dt);
-    std::pair<bool, bool> result = agent->update(dt, hazard, goal, action);
-    particles->update(dt);
-    sprite_render->update(dt);
+    bind(instance);
 
-    step_data.reward.f = result.second * 10.0f;
+    step(instance, action, frame_skip);
 
-    step_data.terminated = !result.first || result.second;
-    step_data.truncated = false;
+    if (instance->render_observations)
+        render_observation(instance, instance->observation.value_buffer.b);
 
     return 0; // No error
 }
 
-int32_t cenv_render() {
-    render_game(false);
-
-    // Grab pixels
-    SDL_LockSurface(window_target);
+int32_t cenv_render_instance(cenv_instance* instance) {
+    bind(instance);
 
-    uint8_t* pixels = (uint8_t*)window_target->pixels;
-
-    for (int x = 0; x < window_width; x++)
-        for (int y = 0; y < window_height; y++) {
-            render_data.value_buffer.b[0 + 3 * (y + window_height * x)] = pixels[0 + 4 * (y + window_height * x)];
-            render_data.value_buffer.b[1 + 3 * (y + window_height * x)] = pixels[1 + 4 * (y + window_height * x)];
-            render_data.value_buffer.b[2 + 3 * (y + window_height * x)] = pixels[2 + 4 * (y + window_height * x)];
-        }
-
-    SDL_UnlockSurface(window_target);
+    render_game(instance, instance->render_data.value_buffer.b, window_width, window_height);
 
     return 0; // No error
 }
 
-void cenv_close() {
+void cenv_close_instance(cenv_instance* instance) {
+    std::lock_guard<std::mutex> lock(instances_mutex);
+
     // ---------------------- CEnv Interface ----------------------
     
     // Dealloc make data
+    cenv_make_data &make_data = instance->make_data;
+
     for (int i = 0; i < make_data.observation_spaces_size; i++)
         free(make_data.observation_spaces[i].value_buffer.f);
 
@@ -408,80 +613,781 @@ void cenv_close() {
     free(make_data.action_spaces);
 
     // Observations
-    free(observation.value_buffer.b);
+    free(instance->observation_storage);
 
     // Frame
-    free(render_data.value_buffer.b);
+    free(instance->render_data.value_buffer.b);
     
     // ---------------------- Game ----------------------
 
-    SDL_DestroyRenderer(window_renderer);
-    SDL_DestroyRenderer(obs_renderer);
+    delete instance;
+
+    num_instances--;
+
+    if (num_instances == 0)
+        close_shared();
+}
+
+int32_t cenv_set_observation_buffer(cenv_instance* instance, int32_t index, void* buffer) {
+    if (index != 0)
+        return 1; // Only one observation
+
+    // Frames are written straight into the caller's memory from now on
+    instance->observation.value_buffer.b = buffer == nullptr ? instance->observation_storage : static_cast<uint8_t*>(buffer);
+
+    return 0; // No error
+}
+
+cenv_make_data* cenv_get_make_data(cenv_instance* instance) {
+    return &instance->make_data;
+}
+
+cenv_reset_data* cenv_get_reset_data(cenv_instance* instance) {
+    return &instance->reset_data;
+}
+
+cenv_step_data* cenv_get_step_data(cenv_instance* instance) {
+    return &instance->step_data;
+}
+
+cenv_render_data* cenv_get_render_data(cenv_instance* instance) {
+    return &instance->render_data;
+}
+
+// ---------------------- Snapshots ----------------------
+
+// Snapshots are only read back by the same build, the version guards against layout changes
+const uint32_t state_magic = 0x54534352; // "RCST"
+const uint32_t state_version = 3;
+
+struct State_Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+};
+
+// In-process snapshot. The tiles are immutable level data, shared with the instance (and every other state of the
+// level) instead of copied, so only the dynamic part is copied per clone
+struct cenv_state {
+    std::shared_ptr<Tile_Grid> tiles;
 
-    SDL_FreeSurface(window_target);
-    SDL_FreeSurface(obs_target);
+    std::vector<uint8_t> data; // As save_dynamic_state writes it
+};
+
+// Everything that changes between resets and steps, apart from the tiles. Assets and the level layer are rebuilt instead
+void save_dynamic_state(cenv_instance* instance, State_Writer &writer) {
+    writer.write(instance->current_map_theme);
+    writer.write(instance->current_background_index);
+    writer.write(instance->current_background_offset_x);
+    writer.write(instance->current_agent_theme);
+
+    writer.write(instance->renderer.camera_position);
+
+    writer.write(instance->step_data.reward.f);
+    writer.write(instance->step_data.terminated);
+    writer.write(instance->step_data.truncated);
+
+    // Next levels come from this, restoring it replays the same resets
+    writer.write(instance->levels.get_rng());
+
+    instance->tilemap->save_state(writer);
+    instance->world.save_state(writer);
+}
+
+// Component data is restored as is, apart from the numbers that index into the shared textures
+// Bools are restored as raw bytes, anything but 0 or 1 is not a bool
+bool valid_bool(const bool &value) {
+    uint8_t byte;
+    std::memcpy(&byte, &value, 1);
+
+    return byte <= 1;
+}
+
+// How far outside the map restored positions may lie, and the largest restored collision box and speed (in units).
+// Anything beyond these never comes out of a step, and the physics turns positions into tile indices
+const float restore_margin = 8.0f;
+const float max_restored_bounds = 4.0f;
+const float max_restored_speed = 100.0f;
+
+// False for NaN and infinities as well
+bool in_range(float value, float low, float high) {
+    return value >= low && value <= high;
+}
+
+bool valid_position(const Vector2 &position, float width, float height) {
+    return in_range(position.x, -restore_margin, width + restore_margin) && in_range(position.y, -restore_margin, height + restore_margin);
+}
+
+template<typename T>
+int component_count(const World &world) {
+    return world.component_manager.get_array(component_type_id<T>())->get_size();
+}
+
+// Checks the restored component fields that the systems index with or rely on
+bool check_components(cenv_instance* instance) {
+    World &world = instance->world;
+
+    float width = instance->tilemap->get_width();
+    float height = instance->tilemap->get_height();
+
+    const Vector2 &camera_position = instance->renderer.camera_position;
+
+    if (!valid_position(Vector2{ camera_position.x * pixels_to_unit, camera_position.y * pixels_to_unit }, width, height))
+        return false;
+
+    // Positions are checked for every entity, not only the ones some system currently holds
+    const Component_Transform* transforms = world.get_component_data<Component_Transform>();
+
+    for (int i = 0; i < component_count<Component_Transform>(world); i++) {
+        if (!valid_position(transforms[i].position, width, height))
+            return false;
+    }
+
+    const Component_Collision* collisions = world.get_component_data<Component_Collision>();
+
+    for (int i = 0; i < component_count<Component_Collision>(world); i++) {
+        const Rectangle &bounds = collisions[i].bounds;
+
+        if (!in_range(bounds.x, -max_restored_bounds, max_restored_bounds) || !in_range(bounds.y, -max_restored_bounds, max_restored_bounds) ||
+            !in_range(bounds.width, 0.0f, max_restored_bounds) || !in_range(bounds.height, 0.0f, max_restored_bounds))
+            return false;
+    }
+
+    const Component_Dynamics* dynamics = world.get_component_data<Component_Dynamics>();
+
+    for (int i = 0; i < component_count<Component_Dynamics>(world); i++) {
+        const Vector2 &velocity = dynamics[i].velocity;
+
+        if (!in_range(velocity.x, -max_restored_speed, max_restored_speed) || !in_range(velocity.y, -max_restored_speed, max_restored_speed))
+            return false;
+    }
+
+    // Mobs move by this instead of Component_Dynamics
+    const Component_Mob_AI* mob_ais = world.get_component_data<Component_Mob_AI>();
+
+    for (int i = 0; i < component_count<Component_Mob_AI>(world); i++) {
+        if (!in_range(mob_ais[i].velocity_x, -max_restored_speed, max_restored_speed))
+            return false;
+    }
+
+    auto valid = [](Texture_ID id) {
+        return id == no_texture || (id >= 0 && id < manager_texture.size());
+    };
+
+    Component_Type animation_type = world.get_component_type<Component_Animation>();
+
+    for (Entity e : instance->sprite_render->entities) {
+        const Component_Sprite &sprite = world.get_component<Component_Sprite>(e);
+
+        if (!valid(sprite.texture) || !valid_bool(sprite.flip_x))
+            return false;
+
+        if (!world.entity_manager.get_signature(e)[animation_type])
+            continue;
+
+        const Component_Animation &animation = world.get_component<Component_Animation>(e);
+
+        if (animation.num_frames < 1 || animation.num_frames > max_animation_frames || animation.frame_index < 0 || animation.frame_index >= animation.num_frames)
+            return false;
+
+        // No animation runs faster than a frame at 60 fps, and t stays in [0, rate) up to rounding, so a step never advances a negative or huge number of frames
+        if (!(animation.rate >= 1.0f / 60.0f && animation.rate < 1000.0f && animation.t > -animation.rate && animation.t < 2.0f * animation.rate))
+            return false;
+
+        for (int i = 0; i < animation.num_frames; i++) {
+            if (!valid(animation.frames[i]))
+                return false;
+        }
+    }
+
+    for (Entity e : instance->agent->entities) {
+        const Component_Agent &agent = world.get_component<Component_Agent>(e);
+
+        if (!valid_bool(agent.on_ground) || !valid_bool(agent.face_forward))
+            return false;
+    }
+
+    return true;
+}
+
+// Expects the tiles to be restored already, tiles_changed tells whether they belong to another level
+int32_t load_dynamic_state(cenv_instance* instance, State_Reader &reader, bool tiles_changed) {
+    // The level layer only has to be baked again for another level
+    int map_theme = instance->current_map_theme;
+    int background_index = instance->current_background_index;
+    float background_offset_x = instance->current_background_offset_x;
+
+    reader.read(instance->current_map_theme);
+    reader.read(instance->current_background_index);
+    reader.read(instance->current_background_offset_x);
+    reader.read(instance->current_agent_theme);
+
+    reader.read(instance->renderer.camera_position);
+
+    // Step data is only committed once the whole snapshot checks out
+    float reward = 0.0f;
+    bool terminated = false;
+    bool truncated = false;
+
+    reader.read(reward);
+    reader.read(terminated);
+    reader.read(truncated);
+
+    std::mt19937 rng;
+    reader.read(rng);
+
+    instance->tilemap->load_state(reader);
+    instance->world.load_state(reader);
+
+    reader.check(!reader.failed && check_components(instance));
+    reader.check(valid_bool(terminated) && valid_bool(truncated));
+
+    reader.check(instance->current_background_index >= 0 && instance->current_background_index < background_textures.size());
+    reader.check(instance->current_map_theme >= 0 && instance->current_map_theme < wall_themes.size());
+    reader.check(instance->current_agent_theme >= 0 && instance->current_agent_theme < agent_themes.size());
+
+    if (reader.failed || reader.offset != reader.size) {
+        // Partially loaded, start over from a fresh level so the instance stays usable
+        reset(instance);
+
+        instance->step_data.reward.f = 0.0f;
+        instance->step_data.terminated = false;
+        instance->step_data.truncated = false;
+
+        if (instance->render_observations)
+            render_observation(instance, instance->observation.value_buffer.b);
+
+        return 1;
+    }
+
+    instance->step_data.reward.f = reward;
+    instance->step_data.terminated = terminated;
+    instance->step_data.truncated = truncated;
+
+    // Restores within an episode leave the RNG as is. Setting it anyway would make a pregenerating pool throw away
+    // its ready levels and generate them again
+    if (rng != instance->levels.get_rng())
+        instance->levels.set_rng(rng);
+
+    // Derived from the restored state
+    instance->hazard->build_grid(instance->tilemap->get_width(), instance->tilemap->get_height());
+    instance->goal->build_grid(instance->tilemap->get_width(), instance->tilemap->get_height());
+
+    if (tiles_changed || map_theme != instance->current_map_theme || background_index != instance->current_background_index || background_offset_x != instance->current_background_offset_x)
+        std::fill(instance->level_layer_baked.begin(), instance->level_layer_baked.end(), false);
+
+    instance->sprite_render->update(0.0f);
+
+    if (instance->render_observations)
+        render_observation(instance, instance->observation.value_buffer.b);
+
+    return 0; // No error
+}
+
+// Byte snapshots carry their own copy of the tiles
+void save_state(cenv_instance* instance, State_Writer &writer) {
+    writer.write(State_Header{ state_magic, state_version, 0 });
+
+    writer.write(*instance->tilemap->get_tiles());
+
+    save_dynamic_state(instance, writer);
+}
+
+int32_t cenv_get_state_instance(cenv_instance* instance, uint8_t* buffer, int32_t buffer_size) {
+    State_Writer writer;
+
+    save_state(instance, writer);
+
+    if (buffer == nullptr || buffer_size < writer.size)
+        return writer.size; // Only measured
+
+    uint32_t size = writer.size;
+
+    writer.data = buffer;
+    writer.size = 0;
+
+    save_state(instance, writer);
+
+    std::memcpy(buffer + offsetof(State_Header, size), &size, sizeof(size));
+
+    return writer.size;
+}
+
+int32_t cenv_set_state_instance(cenv_instance* instance, const uint8_t* buffer, int32_t buffer_size) {
+    State_Reader reader;
+    reader.data = buffer;
+    reader.size = buffer_size;
+
+    State_Header header;
+    reader.read(header);
+
+    if (reader.failed || header.magic != state_magic || header.version != state_version || header.size != buffer_size)
+        return 1; // Not a snapshot of this build, nothing changed
+
+    Tile_Grid tiles;
+    reader.read(tiles);
+
+    if (!reader.check(tiles.is_valid()))
+        return 1; // Nothing changed yet either
+
+    bind(instance);
+
+    bool tiles_changed = instance->tilemap->set_tiles(tiles);
+
+    return load_dynamic_state(instance, reader, tiles_changed);
+}
+
+cenv_state* cenv_make_state() {
+    return new cenv_state();
+}
+
+int32_t cenv_save_state_instance(cenv_instance* instance, cenv_state* state) {
+    state->tiles = instance->tilemap->get_tiles();
+
+    State_Writer writer;
+
+    save_dynamic_state(instance, writer);
+
+    // Reused across saves, reallocates only to grow
+    state->data.resize(writer.size);
+
+    writer.data = state->data.data();
+    writer.size = 0;
+
+    save_dynamic_state(instance, writer);
+
+    return 0; // No error
+}
+
+int32_t cenv_load_state_instance(cenv_instance* instance, const cenv_state* state) {
+    if (state->tiles == nullptr)
+        return 1; // Never saved
+
+    bind(instance);
+
+    bool tiles_changed = instance->tilemap->share_tiles(state->tiles);
+
+    State_Reader reader;
+    reader.data = state->data.data();
+    reader.size = state->data.size();
+
+    return load_dynamic_state(instance, reader, tiles_changed);
+}
+
+void cenv_close_state(cenv_state* state) {
+    delete state;
+}
+
+// ---------------------- Batches ----------------------
+
+cenv_batch* cenv_make_batch(int32_t cenv_version, int32_t num_instances, const char* render_mode, cenv_option* options, int32_t options_size) {
+    if (cenv_version != CENV_VERSION || num_instances <= 0)
+        return nullptr;
+
+    cenv_batch* batch = new cenv_batch();
+
+    // Instance i gets seed + i
+    std::vector<cenv_option> instance_options(options, options + options_size);
+
+    int seed_index = -1;
+
+    for (int i = 0; i < options_size; i++) {
+        if (std::string(options[i].name) == "seed")
+            seed_index = i;
+    }
+
+    if (seed_index == -1) {
+        cenv_option seed_option;
+        seed_option.name = "seed";
+        seed_option.value_type = CENV_VALUE_TYPE_INT;
+        seed_option.value.i = time(nullptr);
+
+        seed_index = instance_options.size();
+        instance_options.push_back(seed_option);
+    }
+
+    int32_t base_seed = instance_options[seed_index].value.i;
+
+    int num_threads = 1;
+    bool work_stealing = true;
+
+    for (int i = 0; i < options_size; i++) {
+        std::string name(options[i].name);
+
+        if (name == "num_threads") {
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            num_threads = options[i].value.i;
+        }
+        else if (name == "work_stealing") {
+            // 0 gives every thread a fixed slice of the instances, to measure what stealing buys
+            assert(options[i].value_type == CENV_VALUE_TYPE_INT);
+
+            work_stealing = options[i].value.i != 0;
+        }
+    }
+
+    batch->pool.init(num_threads, work_stealing);
+
+    batch->reset_task = [batch](int i) { reset_batch_instance(batch, i); };
+    batch->step_task = [batch](int i) { step_batch_instance(batch, i); };
+
+    // Sized once, async steps copy the actions into it
+    batch->async_actions.resize(num_instances);
+
+    batch->instances.resize(num_instances);
+
+    for (int i = 0; i < num_instances; i++) {
+        instance_options[seed_index].value.i = base_seed + i;
+
+        batch->instances[i] = cenv_make_instance(cenv_version, render_mode, instance_options.data(), instance_options.size());
+
+        if (batch->instances[i] == nullptr) {
+            batch->instances.resize(i);
+
+            cenv_close_batch(batch);
+
+            return nullptr;
+        }
+    }
+
+    return batch;
+}
+
+int32_t cenv_reset_batch(cenv_batch* batch, void* observations) {
+    if (batch->pool.is_running_async())
+        return 1; // Must call cenv_step_batch_wait first
+
+    batch->observations = observations;
+
+    batch->pool.run(batch->instances.size(), batch->reset_task);
+
+    return 0; // No error
+}
+
+// Task that resets instance i of a batch
+void reset_batch_instance(cenv_batch* batch, int i) {
+    const int observation_size = obs_width * obs_height * 3;
+
+    cenv_instance* instance = batch->instances[i];
+
+    bind(instance);
+
+    reset(instance);
+
+    if (instance->render_observations)
+        render_observation(instance, static_cast<uint8_t*>(batch->observations) + i * observation_size);
+}
+
+// Task that steps instance i of a batch
+void step_batch_instance(cenv_batch* batch, int i) {
+    const int observation_size = obs_width * obs_height * 3;
+
+    cenv_instance* instance = batch->instances[i];
+
+    bind(instance);
+
+    step(instance, batch->actions[i], instance->frame_skip);
+
+    batch->rewards[i] = instance->step_data.reward.f;
+    batch->terminated[i] = instance->step_data.terminated;
+    batch->truncated[i] = instance->step_data.truncated;
+
+    // Auto-reset, the returned observation is the first one of the new level
+    if (batch->terminated[i] || batch->truncated[i])
+        reset(instance);
+
+    if (instance->render_observations)
+        render_observation(instance, static_cast<uint8_t*>(batch->observations) + i * observation_size);
+}
+
+void set_step_arguments(cenv_batch* batch, const int32_t* actions, void* observations, float* rewards, bool* terminated, bool* truncated) {
+    batch->actions = actions;
+    batch->observations = observations;
+    batch->rewards = rewards;
+    batch->terminated = terminated;
+    batch->truncated = truncated;
+}
+
+int32_t cenv_step_batch(cenv_batch* batch, const int32_t* actions, void* observations, float* rewards, bool* terminated, bool* truncated) {
+    if (batch->pool.is_running_async())
+        return 1; // Must call cenv_step_batch_wait first
+
+    set_step_arguments(batch, actions, observations, rewards, terminated, truncated);
+
+    // Instances are independent, spread them over the pool
+    batch->pool.run(batch->instances.size(), batch->step_task);
+
+    return 0; // No error
+}
+
+int32_t cenv_step_batch_async(cenv_batch* batch, const int32_t* actions, void* observations, float* rewards, bool* terminated, bool* truncated) {
+    if (batch->pool.is_running_async())
+        return 1; // Must call cenv_step_batch_wait first
+
+    // Caller may reuse its action array right away
+    batch->async_actions.assign(actions, actions + batch->instances.size());
+
+    set_step_arguments(batch, batch->async_actions.data(), observations, rewards, terminated, truncated);
+
+    batch->pool.run_async(batch->instances.size(), batch->step_task);
+
+    return 0; // No error
+}
+
+int32_t cenv_step_batch_wait(cenv_batch* batch) {
+    batch->pool.wait();
+
+    return 0; // No error
+}
+
+int32_t cenv_get_batch_size(cenv_batch* batch) {
+    return batch->instances.size();
+}
+
+cenv_instance* cenv_get_batch_instance(cenv_batch* batch, int32_t index) {
+    if (index < 0 || index >= batch->instances.size())
+        return nullptr;
+
+    return batch->instances[index];
+}
+
+void cenv_close_batch(cenv_batch* batch) {
+    batch->pool.wait();
+
+    for (int i = 0; i < batch->instances.size(); i++)
+        cenv_close_instance(batch->instances[i]);
+
+    delete batch;
+}
+
+// ---------------------- Shared ----------------------
+
+void init_shared() {
+    // SDL_image only decodes assets, all drawing is done by the rasterizer
+    IMG_Init(IMG_INIT_PNG);
+
+    // Pixels per world unit of the obs and window cameras (see render_game)
+    texture_unit_sizes = { game_zoom * unit_to_pixels, game_zoom * unit_to_pixels * window_width / obs_width };
+}
+
+void close_shared() {
+    background_textures.clear();
+    manager_texture.clear();
+
+    IMG_Quit();
+}
+
+// ---------------------- Game ----------------------
+
+void bind(cenv_instance* instance) {
+    gr = &instance->renderer;
 }
 
 // Rendering
-void render_game(bool is_obs) {
-    // If obs, set render to obs target
-    gr.rendering_obs = is_obs;
+void render_game(cenv_instance* instance, uint8_t* pixels, int width, int height) {
+    // Draw straight into the RGB8 destination
+    gr->target = Render_Target{ pixels, width, height };
+
+    gr->clear(Color{ 0, 0, 0, 255 });
+
+    gr->camera_scale = game_zoom * static_cast<float>(width) / static_cast<float>(obs_width);
+    gr->camera_size = (Vector2){ static_cast<float>(width), static_cast<float>(height) };
 
-    SDL_SetRenderDrawColor(gr.get_renderer(), 0, 0, 0, 255);
-    SDL_RenderClear(gr.get_renderer());
-    SDL_SetRenderDrawColor(gr.get_renderer(), 255, 255, 255, 255);
+    // Background and tiles don't change during an episode, the obs camera copies them from the baked layer.
+    // Sprites sorted behind the tiles need the layers drawn separately
+    bool is_obs = width == obs_width && height == obs_height;
 
-    int width = is_obs ? obs_width : window_width;
-    int height = is_obs ? obs_height : window_height;
+    if (is_obs && !instance->sprite_render->has_negative_z())
+        render_level_layer(instance);
+    else {
+        render_background(instance);
 
-    gr.camera_scale = game_zoom * static_cast<float>(width) / static_cast<float>(obs_width);
-    gr.camera_size = (Vector2){ static_cast<float>(width), static_cast<float>(height) };
+        instance->sprite_render->render(negative_z);
+        instance->tilemap->render(instance->current_map_theme);
+    }
+
+    instance->particles->render();
+    instance->sprite_render->render(positive_z);
+    instance->agent->render(instance->current_agent_theme);
+}
 
-    // Draw background image
-    Asset_Texture* background = &background_textures[current_background_index];
+void render_background(cenv_instance* instance) {
+    Asset_Texture* background = background_textures[instance->current_background_index];
 
     float background_aspect = static_cast<float>(background->width) / static_cast<float>(background->height);
     float extra_width = background_aspect - 1.0f; // 1 for game world aspect, which is 64x64 tiles
     
-    gr.render_texture(background, Vector2{ -current_background_offset_x * extra_width, 0.0f }, 64.0f * unit_to_pixels / background->height);
+    gr->render_texture(background, Vector2{ -instance->current_background_offset_x * extra_width, 0.0f }, 64.0f * unit_to_pixels / background->height);
+}
+
+// Draw background and tiles into one chunk of the level layer
+void bake_level_layer_chunk(cenv_instance* instance, int chunk_x, int chunk_y) {
+    Render_Target chunk{ instance->level_layer_pixels.data() + (chunk_y * instance->level_layer_chunks_x + chunk_x) * layer_chunk_size * layer_chunk_size * 3, layer_chunk_size, layer_chunk_size };
+
+    // Point the renderer at the chunk, the camera belongs to the agent so restore it afterwards
+    Render_Target target = gr->target;
+    Vector2 camera_position = gr->camera_position;
+    Vector2 camera_size = gr->camera_size;
+
+    gr->target = chunk;
+    gr->camera_size = Vector2{ static_cast<float>(layer_chunk_size), static_cast<float>(layer_chunk_size) };
+    gr->camera_position = Vector2{ instance->level_layer_position.x + (chunk_x + 0.5f) * layer_chunk_size / gr->camera_scale,
+        instance->level_layer_position.y + (chunk_y + 0.5f) * layer_chunk_size / gr->camera_scale };
+
+    gr->clear(Color{ 0, 0, 0, 255 });
+
+    render_background(instance);
+
+    instance->tilemap->render(instance->current_map_theme);
 
-    sprite_render->render(negative_z);
-    tilemap->render(current_map_theme);
-    particles->render();
-    sprite_render->render(positive_z);
-    agent->render(current_agent_theme);
+    gr->target = target;
+    gr->camera_position = camera_position;
+    gr->camera_size = camera_size;
+
+    instance->level_layer_baked[chunk_y * instance->level_layer_chunks_x + chunk_x] = true;
 }
 
-void reset() {
-    c.clear_entities();
+// Copy the visible part of the level layer, baking chunks as they come into view
+void render_level_layer(cenv_instance* instance) {
+    if (instance->level_layer_chunks_x == 0) {
+        // The camera can look past the map edges (out of bounds is a wall), the layer has a border for it
+        const int border = std::ceil(0.5f * obs_width / (gr->camera_scale * unit_to_pixels)) + 1;
 
-    tilemap->regenerate(rng, tilemap_config);
+        int width = std::ceil((instance->tilemap->get_width() + 2 * border) * unit_to_pixels * gr->camera_scale);
+        int height = std::ceil((instance->tilemap->get_height() + 2 * border) * unit_to_pixels * gr->camera_scale);
 
-    // Determine background (themeing)
-    std::uniform_int_distribution<int> background_dist(0, background_textures.size() - 1);
+        instance->level_layer_chunks_x = (width + layer_chunk_size - 1) / layer_chunk_size;
+        instance->level_layer_chunks_y = (height + layer_chunk_size - 1) / layer_chunk_size;
 
-    current_background_index = background_dist(rng);
+        instance->level_layer_pixels.resize(instance->level_layer_chunks_x * instance->level_layer_chunks_y * layer_chunk_size * layer_chunk_size * 3);
+        instance->level_layer_baked.assign(instance->level_layer_chunks_x * instance->level_layer_chunks_y, false);
 
-    std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+        instance->level_layer_position = Vector2{ -border * unit_to_pixels, -border * unit_to_pixels };
+    }
 
-    current_background_offset_x = dist01(rng);
+    std::pair<int, int> offset = gr->get_layer_offset(instance->level_layer_position);
 
-    // Spawn the player (agent)
-    Entity e = c.create_entity();
+    int lower_x = std::max(0, offset.first / layer_chunk_size);
+    int lower_y = std::max(0, offset.second / layer_chunk_size);
+    int upper_x = std::min(instance->level_layer_chunks_x - 1, (offset.first + gr->target.width - 1) / layer_chunk_size);
+    int upper_y = std::min(instance->level_layer_chunks_y - 1, (offset.second + gr->target.height - 1) / layer_chunk_size);
+
+    for (int y = lower_y; y <= upper_y; y++)
+        for (int x = lower_x; x <= upper_x; x++) {
+            if (!instance->level_layer_baked[y * instance->level_layer_chunks_x + x])
+                bake_level_layer_chunk(instance, x, y);
+
+            Render_Target chunk{ instance->level_layer_pixels.data() + (y * instance->level_layer_chunks_x + x) * layer_chunk_size * layer_chunk_size * 3, layer_chunk_size, layer_chunk_size };
 
-    Vector2 pos{ 1.5f, tilemap->get_height() - 1 - 1.0f };
+            raster_copy(gr->target, chunk, offset.first - x * layer_chunk_size, offset.second - y * layer_chunk_size);
+        }
+}
+
+// Render the observation, instances have their own targets so this is safe to call concurrently
+void render_observation(cenv_instance* instance, uint8_t* observation) {
+    if (!instance->channels_first) {
+        render_game(instance, observation, obs_width, obs_height);
+
+        return;
+    }
+
+    // The rasterizer blends interleaved pixels, split them into planes as the final pass
+    render_game(instance, instance->interleaved_frame.data(), obs_width, obs_height);
+
+    raster_to_planar(Render_Target{ instance->interleaved_frame.data(), obs_width, obs_height }, observation);
+}
+
+// Applies the action for frame_skip updates (fewer if the episode ends) and sets the step data, rendering is up to the caller
+void step(cenv_instance* instance, int action, int frame_skip) {
+    float reward = 0.0f;
+    bool terminated = false;
+
+    for (int i = 0; i < frame_skip && !terminated; i++) {
+        // Update systems
+        instance->mob_ai->update(dt);
+        std::pair<bool, bool> result = instance->agent->update(dt, action);
+        instance->particles->update(dt);
+        instance->sprite_render->update(dt);
+
+        reward += result.second * 10.0f;
+
+        terminated = !result.first || result.second;
+    }
 
-    c.add_component(e, Component_Transform{ .position{ pos } });
-    c.add_component(e, Component_Collision{ .bounds{ -0.5f, -1.0f, 1.0f, 1.0f } });
-    c.add_component(e, Component_Dynamics{});
-    c.add_component(e, Component_Agent{});
+    instance->step_data.reward.f = reward;
+
+    instance->step_data.terminated = terminated;
+    instance->step_data.truncated = false;
+}
+
+void generate_level(Level_Descriptor &level, std::mt19937 &rng, const System_Tilemap::Config &config) {
+    System_Tilemap::generate(level.layout, rng, config);
+
+    // Determine background (themeing)
+    std::uniform_int_distribution<int> background_dist(0, background_names.size() - 1);
+
+    level.background_index = background_dist(rng);
+
+    std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+
+    level.background_offset_x = dist01(rng);
 
     // Determine themes
     std::uniform_int_distribution<int> agent_theme_dist(0, agent_themes.size() - 1);
 
-    current_agent_theme = agent_theme_dist(rng);
+    level.agent_theme = agent_theme_dist(rng);
 
     std::uniform_int_distribution<int> map_theme_dist(0, wall_themes.size() - 1);
 
-    current_map_theme = map_theme_dist(rng);
+    level.map_theme = map_theme_dist(rng);
+}
+
+bool is_valid_level(const Level_Descriptor &level) {
+    return level.layout.is_valid() &&
+        level.background_index >= 0 && level.background_index < background_names.size() &&
+        level.background_offset_x >= 0.0f && level.background_offset_x <= 1.0f &&
+        level.agent_theme >= 0 && level.agent_theme < agent_themes.size() &&
+        level.map_theme >= 0 && level.map_theme < wall_themes.size();
+}
+
+void reset(cenv_instance* instance) {
+    World &world = instance->world;
+
+    world.clear_entities();
+
+    instance->levels.acquire(instance->level);
+
+    const Level_Descriptor &level = instance->level;
+
+    instance->tilemap->install(level.layout);
+
+    instance->hazard->build_grid(instance->tilemap->get_width(), instance->tilemap->get_height());
+    instance->goal->build_grid(instance->tilemap->get_width(), instance->tilemap->get_height());
+
+    instance->current_background_index = level.background_index;
+    instance->current_background_offset_x = level.background_offset_x;
+    instance->current_agent_theme = level.agent_theme;
+    instance->current_map_theme = level.map_theme;
+
+    // Spawn the player (agent)
+    Entity e = world.create_entity();
+
+    Vector2 pos{ 1.5f, instance->tilemap->get_height() - 1 - 1.0f };
+
+    world.add_components(e,
+        Component_Transform{ .position{ pos } },
+        Component_Collision{ .bounds{ -0.5f, -1.0f, 1.0f, 1.0f } },
+        Component_Dynamics{},
+        Component_Agent{});
+
+    // New level, chunks are baked again as they come into view
+    std::fill(instance->level_layer_baked.begin(), instance->level_layer_baked.end(), false);
+
+    // The first observation is rendered before any update, so point the camera at the agent
+    // and sort the new sprites here instead of leaving both from the previous level
+    gr->camera_position.x = pos.x * unit_to_pixels;
+    gr->camera_position.y = (pos.y - 0.5f) * unit_to_pixels;
+
+    instance->sprite_render->update(0.0f);
 }
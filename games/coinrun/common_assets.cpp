@@ -1,26 +1,180 @@
 #include "common_assets.h"
 
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+// Area (box) filter weights mapping src_size samples onto dst_size samples
+struct Area_Weights {
+    std::vector<int> first; // First source sample of each destination sample
+    std::vector<std::vector<float>> weights;
+};
+
+Area_Weights area_weights(int src_size, int dst_size) {
+    Area_Weights result;
+
+    result.first.resize(dst_size);
+    result.weights.resize(dst_size);
+
+    float ratio = static_cast<float>(src_size) / static_cast<float>(dst_size);
+
+    for (int i = 0; i < dst_size; i++) {
+        float start = i * ratio;
+        float end = std::min(static_cast<float>(src_size), (i + 1) * ratio);
+
+        int first = static_cast<int>(start);
+        int last = std::min(src_size - 1, static_cast<int>(std::ceil(end)) - 1);
+
+        result.first[i] = first;
+
+        for (int j = first; j <= last; j++) {
+            float overlap = std::min(end, j + 1.0f) - std::max(start, static_cast<float>(j));
+
+            result.weights[i].push_back(overlap / ratio);
+        }
+    }
+
+    return result;
+}
+
+// Downscale premultiplied texels, averaging premultiplied values keeps edges free of dark fringes
+Texture_Level resample(const Texture_Level &src, int width, int height) {
+    Area_Weights weights_x = area_weights(src.width, width);
+    Area_Weights weights_y = area_weights(src.height, height);
+
+    // Horizontal pass
+    std::vector<float> horizontal(width * src.height * 4, 0.0f);
+
+    for (int y = 0; y < src.height; y++)
+        for (int x = 0; x < width; x++) {
+            float* dst = horizontal.data() + (y * width + x) * 4;
+
+            for (int i = 0; i < weights_x.weights[x].size(); i++) {
+                const uint8_t* texel = src.texels.data() + (y * src.width + weights_x.first[x] + i) * 4;
+
+                for (int k = 0; k < 4; k++)
+                    dst[k] += texel[k] * weights_x.weights[x][i];
+            }
+        }
+
+    // Vertical pass
+    Texture_Level level;
+
+    level.width = width;
+    level.height = height;
+    level.texels.resize(width * height * 4);
+
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            for (int i = 0; i < weights_y.weights[y].size(); i++) {
+                const float* value = horizontal.data() + ((weights_y.first[y] + i) * width + x) * 4;
+
+                for (int k = 0; k < 4; k++)
+                    sum[k] += value[k] * weights_y.weights[y][i];
+            }
+
+            uint8_t* texel = level.texels.data() + (y * width + x) * 4;
+
+            for (int k = 0; k < 4; k++)
+                texel[k] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, sum[k] + 0.5f)));
+
+            if (texel[3] != 0)
+                level.opaque = false;
+        }
+
+    return level;
+}
+
 void Asset_Texture::load(const std::string &name) {
-    SDL_Surface* surface = IMG_Load(name.c_str());
+    SDL_Surface* loaded = IMG_Load(name.c_str());
 
-    if (surface == nullptr)
+    if (loaded == nullptr)
         throw std::runtime_error("Could not load surface \"" + name + "\"!");
 
+    // SDL is only used to decode, the pixels are converted to rasterizer texels once here
+    SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+
+    SDL_FreeSurface(loaded);
+
+    if (surface == nullptr)
+        throw std::runtime_error("Could not convert surface \"" + name + "\"!");
+
     width = surface->w;
     height = surface->h;
 
-    window_texture = SDL_CreateTextureFromSurface(gr.window_renderer, surface);
-    obs_texture = SDL_CreateTextureFromSurface(gr.obs_renderer, surface);
+    levels.resize(1);
+
+    Texture_Level &base = levels[0];
+
+    base.width = width;
+    base.height = height;
+    base.texels.resize(width * height * 4);
+
+    SDL_LockSurface(surface);
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = static_cast<const uint8_t*>(surface->pixels) + y * surface->pitch;
+
+        for (int x = 0; x < width; x++) {
+            const uint8_t* pixel = row + x * 4;
+            uint8_t* texel = base.texels.data() + (y * width + x) * 4;
+
+            int alpha = pixel[3];
+
+            texel[0] = (pixel[0] * alpha + 127) / 255;
+            texel[1] = (pixel[1] * alpha + 127) / 255;
+            texel[2] = (pixel[2] * alpha + 127) / 255;
+            texel[3] = 255 - alpha;
+
+            if (alpha != 255)
+                base.opaque = false;
+        }
+    }
+
+    SDL_UnlockSurface(surface);
 
     SDL_FreeSurface(surface);
+
+    // Mip pyramid for sizes that are not known up front (particles, scaled sprites)
+    for (int level_width = width / 2, level_height = height / 2; level_width >= 1 && level_height >= 1; level_width /= 2, level_height /= 2)
+        add_level(level_width, level_height);
+
+    // Exact sizes for a texture one unit wide
+    for (float unit_size : texture_unit_sizes)
+        add_level(std::round(unit_size), std::round(unit_size * height / width));
+}
+
+void Asset_Texture::add_level(int level_width, int level_height) {
+    // Only minified copies are useful, magnification samples the full resolution image
+    if (level_width < 1 || level_height < 1 || level_width >= width || level_height >= height)
+        return;
+
+    for (const Texture_Level &level : levels) {
+        if (level.width == level_width && level.height == level_height)
+            return;
+    }
+
+    levels.push_back(resample(levels[0], level_width, level_height));
 }
 
-Asset_Texture::~Asset_Texture() {
-    if (window_texture != nullptr)
-        SDL_DestroyTexture(window_texture);
+const Texture_Level &Asset_Texture::get_level(float dst_width) const {
+    // Closest width by ratio so sampling is as near to 1:1 as the cache allows
+    int best_index = 0;
+    float best_ratio = 0.0f;
 
-    if (obs_texture != nullptr)
-        SDL_DestroyTexture(obs_texture);
+    for (int i = 0; i < levels.size(); i++) {
+        float ratio = levels[i].width > dst_width ? levels[i].width / dst_width : dst_width / levels[i].width;
+
+        if (i == 0 || ratio < best_ratio) {
+            best_index = i;
+            best_ratio = ratio;
+        }
+    }
+
+    return levels[best_index];
 }
 
+std::vector<float> texture_unit_sizes;
+
 Asset_Manager<Asset_Texture> manager_texture;
@@ -4,22 +4,55 @@
 
 #include "renderer.h"
 
+#include <vector>
 #include <stdexcept>
 
+// One pre-filtered copy of a texture
+struct Texture_Level {
+    // Premultiplied RGB + inverse alpha, see Raster_Image
+    std::vector<uint8_t> texels;
+
+    int width = 0;
+    int height = 0;
+
+    bool opaque = true;
+
+    Raster_Image get_image() const {
+        return Raster_Image{ texels.data(), width, height, opaque };
+    }
+};
+
 class Asset_Texture {
 public:
-    // SDL requires different textures for different renders for some reason
-    SDL_Texture* obs_texture = nullptr;
-    SDL_Texture* window_texture = nullptr;
+    // Level 0 is the full resolution image, the rest are smaller copies made at load time
+    std::vector<Texture_Level> levels;
 
+    // Full resolution size
     int width = 0;
     int height = 0;
 
     // Required
     void load(const std::string &name);
 
-    ~Asset_Texture();
+    // Add a copy pre-filtered to the given size, used for sizes known to appear on screen
+    void add_level(int level_width, int level_height);
+
+    // Level closest to the size the texture is drawn at
+    const Texture_Level &get_level(float dst_width) const;
 };
 
+// On-screen size of a world unit for each camera. Textures get a level at these sizes for
+// one unit of width on load, which is how wide tiles, mobs, items and the agent are drawn
+extern std::vector<float> texture_unit_sizes;
+
 // Manager for all textures
 extern Asset_Manager<Asset_Texture> manager_texture;
+
+// Texture by its manager id, components hold these instead of pointers
+typedef int16_t Texture_ID;
+
+const Texture_ID no_texture = -1;
+
+inline Asset_Texture* get_texture(Texture_ID id) {
+    return id == no_texture ? nullptr : &manager_texture.get_by_id(id);
+}
@@ -30,11 +30,16 @@ struct Component_Sprite {
     Color tint{ 255, 255, 255, 255 };
     float z = 0.0f; // Ordering
 
-    Asset_Texture* texture = nullptr;
+    Texture_ID texture = no_texture;
 };
 
+// Inline storage so components never allocate
+const int max_animation_frames = 4;
+const int max_particles = 10;
+
 struct Component_Animation { // Requires a Component_Sprite as well in order to function
-    std::vector<Asset_Texture*> frames;
+    std::array<Texture_ID, max_animation_frames> frames{};
+    int num_frames = 0;
 
     int frame_index = 0;
     float rate = 0.017f;
@@ -67,7 +72,7 @@ struct Particle {
 };
 
 struct Component_Particles {
-    std::vector<Particle> particles;
+    std::array<Particle, max_particles> particles;
 
     Vector2 offset{ 0.0f, 0.0f };
     float lifespan = 0.75f;
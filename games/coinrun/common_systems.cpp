@@ -4,6 +4,10 @@
 
 #include "helpers.h"
 
+void System_Sprite_Render::init() {
+    render_entities.reserve(max_entities);
+}
+
 void System_Sprite_Render::update(float dt) {
     if (render_entities.size() != entities.size())
         render_entities.resize(entities.size());
@@ -11,19 +15,19 @@ void System_Sprite_Render::update(float dt) {
     int index = 0;
 
     for (auto const &e : entities) {
-        auto &sprite = c.get_component<Component_Sprite>(e);
+        auto &sprite = world->get_component<Component_Sprite>(e);
 
         // If also has animation
-        if (c.entity_manager.get_signature(e)[c.component_manager.get_component_type<Component_Animation>()]) {
+        if (world->entity_manager.get_signature(e)[world->component_manager.get_component_type<Component_Animation>()]) {
             // Has animation component
-            auto &animation = c.get_component<Component_Animation>(e);
+            auto &animation = world->get_component<Component_Animation>(e);
 
             animation.t += dt;
 
             int frames_advance = animation.t / animation.rate;
             animation.t -= frames_advance * animation.rate; 
                 
-            animation.frame_index = (animation.frame_index + frames_advance) % animation.frames.size();
+            animation.frame_index = (animation.frame_index + frames_advance) % animation.num_frames;
 
             sprite.texture = animation.frames[animation.frame_index];
         }
@@ -32,9 +36,13 @@ void System_Sprite_Render::update(float dt) {
         index++;
     }
     
-    // Sort sprites
+    // Sort sprites. Equal z is drawn by entity slot, a total order, so the draw order does not depend on how the entity set
+    // was shuffled by removals (and std::sort stays deterministic without the buffer std::stable_sort allocates)
     std::sort(render_entities.begin(), render_entities.end(), [](const std::pair<float, Entity> &left, const std::pair<float, Entity> &right) {
-        return left.first < right.first;
+        if (left.first != right.first)
+            return left.first < right.first;
+
+        return entity_index(left.second) < entity_index(right.second);
     });
 }
 
@@ -43,10 +51,10 @@ void System_Sprite_Render::render(Sprite_Render_Mode mode) {
     for (size_t i = 0; i < render_entities.size(); i++) {
         Entity e = render_entities[i].second;
 
-        auto const &sprite = c.get_component<Component_Sprite>(e);
-        auto const &transform = c.get_component<Component_Transform>(e);
+        auto const &sprite = world->get_component<Component_Sprite>(e);
+        auto const &transform = world->get_component<Component_Transform>(e);
 
-        if (sprite.texture == nullptr)
+        if (sprite.texture == no_texture)
             continue;
 
         // Sorting relative to tile map system - negative is behind, positive in front
@@ -57,19 +65,18 @@ void System_Sprite_Render::render(Sprite_Render_Mode mode) {
 
         float scale = transform.scale * sprite.scale;
 
+        Asset_Texture* texture = get_texture(sprite.texture);
+
         // If visible
-        gr.render_texture(sprite.texture, (Vector2){ (transform.position.x + sprite.position.x) * unit_to_pixels, (transform.position.y + sprite.position.y) * unit_to_pixels }, scale * unit_to_pixels / sprite.texture->width, 1.0f, sprite.flip_x);
+        gr->render_texture(texture, (Vector2){ (transform.position.x + sprite.position.x) * unit_to_pixels, (transform.position.y + sprite.position.y) * unit_to_pixels }, scale * unit_to_pixels / texture->width, 1.0f, sprite.flip_x);
     }
 }
 
 void System_Mob_AI::update(float dt) {
-    // Get tile map system
-    std::shared_ptr<System_Tilemap> tilemap = c.system_manager.get_system<System_Tilemap>();
-
     for (auto const &e : entities) {
-        auto &mob_ai = c.get_component<Component_Mob_AI>(e);
+        auto &mob_ai = world->get_component<Component_Mob_AI>(e);
 
-        auto &transform = c.get_component<Component_Transform>(e);
+        auto &transform = world->get_component<Component_Transform>(e);
 
         // Move
         transform.position.x += mob_ai.velocity_x * dt;
@@ -77,13 +84,9 @@ void System_Mob_AI::update(float dt) {
         Rectangle wall_sensor{ transform.position.x - 0.5f, transform.position.y - 0.6f, 1.0f, 0.5f };
         Rectangle floor_sensor{ transform.position.x - 0.5f, transform.position.y + 0.6f, 1.0f, 0.5f };
 
-        std::pair<Vector2, bool> wall_collision_data = tilemap->get_collision(wall_sensor, [](Tile_ID id) -> Collision_Type {
-            return (id == wall_mid || id == wall_top ? full : none);
-        });
+        std::pair<Vector2, bool> wall_collision_data = tilemap->get_collision(wall_sensor, wall_collision_table);
 
-        std::pair<Vector2, bool> floor_collision_data = tilemap->get_collision(floor_sensor, [](Tile_ID id) -> Collision_Type {
-            return (id == empty ? full : none);
-        });
+        std::pair<Vector2, bool> floor_collision_data = tilemap->get_collision(floor_sensor, empty_collision_table);
 
         float new_x = wall_collision_data.first.x + 0.5f;
 
@@ -94,16 +97,36 @@ void System_Mob_AI::update(float dt) {
 
         transform.position.x = new_x;
 
+        hazard->grid.move(e, transform.position);
+
         if (wall_collision_data.second || floor_collision_data.second)
             mob_ai.velocity_x *= -1.0f; // Rebound
 
         // Flip sprite if needed
-        auto &sprite = c.get_component<Component_Sprite>(e);
+        auto &sprite = world->get_component<Component_Sprite>(e);
 
         sprite.flip_x = mob_ai.velocity_x > 0.0f;
     }
 }
 
+void System_Hazard::build_grid(int map_width, int map_height) {
+    grid.clear(map_width, map_height);
+
+    // The group keeps the hazard transforms and collisions in matching contiguous columns
+    const Component_Transform* transforms = world->get_component_data<Component_Transform>();
+    const Component_Collision* collisions = world->get_component_data<Component_Collision>();
+
+    for (int i = 0; i < group->size; i++)
+        grid.insert(world->get_component_entity<Component_Transform>(i), transforms[i].position, collisions[i].bounds);
+}
+
+void System_Goal::build_grid(int map_width, int map_height) {
+    grid.clear(map_width, map_height);
+
+    for (auto const &e : entities)
+        grid.insert(e, world->get_component<Component_Transform>(e).position, world->get_component<Component_Collision>(e).bounds);
+}
+
 void System_Agent::init() {
     stand_textures.resize(agent_themes.size());
     jump_textures.resize(agent_themes.size());
@@ -111,14 +134,14 @@ void System_Agent::init() {
     walk2_textures.resize(agent_themes.size());
 
     for (int i = 0; i < agent_themes.size(); i++) {
-        stand_textures[i].load("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_stand.png");
-        jump_textures[i].load("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_jump.png");
-        walk1_textures[i].load("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_walk1.png");
-        walk2_textures[i].load("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_walk2.png");
+        stand_textures[i] = &manager_texture.get("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_stand.png");
+        jump_textures[i] = &manager_texture.get("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_jump.png");
+        walk1_textures[i] = &manager_texture.get("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_walk1.png");
+        walk2_textures[i] = &manager_texture.get("assets/kenney/Players/128x256/" + agent_themes[i] + "/alien" + agent_themes[i] + "_walk2.png");
     }
 }
 
-std::pair<bool, bool> System_Agent::update(float dt, const std::shared_ptr<System_Hazard> &hazard, const std::shared_ptr<System_Goal> &goal, int action) {
+std::pair<bool, bool> System_Agent::update(float dt, int action) {
     bool alive = true;
     bool achieved_goal = false;
 
@@ -129,21 +152,18 @@ std::pair<bool, bool> System_Agent::update(float dt, const std::shared_ptr<Syste
     const float mix = 12.0f;
     const float air_control = 0.15f;
 
-    // Get tile map system
-    std::shared_ptr<System_Tilemap> tilemap = c.system_manager.get_system<System_Tilemap>();
-
     assert(entities.size() == 1); // Only one player
 
     for (auto const &e : entities) {
-        auto &agent = c.get_component<Component_Agent>(e);
+        auto &agent = world->get_component<Component_Agent>(e);
 
         // Set action
         agent.action = action;
 
-        auto &transform = c.get_component<Component_Transform>(e);
-        auto &dynamics = c.get_component<Component_Dynamics>(e);
+        auto &transform = world->get_component<Component_Transform>(e);
+        auto &dynamics = world->get_component<Component_Dynamics>(e);
 
-        const auto &collision = c.get_component<Component_Collision>(e);
+        const auto &collision = world->get_component<Component_Collision>(e);
 
         float movement_x = (agent.action == 0 || agent.action == 1 || agent.action == 2) - (agent.action == 6 || agent.action == 7 || agent.action == 8);
         bool jump = (agent.action == 2 || agent.action == 5 || agent.action == 8);
@@ -178,9 +198,7 @@ std::pair<bool, bool> System_Agent::update(float dt, const std::shared_ptr<Syste
         // World space collision
         Rectangle world_collision{ transform.position.x + collision.bounds.x, transform.position.y + collision.bounds.y, collision.bounds.width, collision.bounds.height };
 
-        std::pair<Vector2, bool> collision_data = tilemap->get_collision(world_collision, [](Tile_ID id) -> Collision_Type {
-            return (id == wall_mid || id == wall_top ? full : (id == crate ? down_only : none));
-        }, dynamics.velocity.y);
+        std::pair<Vector2, bool> collision_data = tilemap->get_collision(world_collision, agent_collision_table, dynamics.velocity.y);
 
         // Update no collide mask (for fallthrough platform logic) given some large bounds to check around the agent
         tilemap->update_no_collide(world_collision, Rectangle{ transform.position.x - 4.0f, transform.position.y - 4.0f, 8.0f, 8.0f });
@@ -204,47 +222,23 @@ std::pair<bool, bool> System_Agent::update(float dt, const std::shared_ptr<Syste
         if (agent.on_ground)
             dynamics.velocity.y = 0.0f;
 
-        // Go through all hazards
-        for (auto const &h : hazard->get_entities()) {
-            auto const &hazard_transform = c.get_component<Component_Transform>(h);
-            auto const &hazard_collision = c.get_component<Component_Collision>(h);
-
-            // World space
-            Rectangle hazard_world_collision{ hazard_transform.position.x + hazard_collision.bounds.x, hazard_transform.position.y + hazard_collision.bounds.y, hazard_collision.bounds.width, hazard_collision.bounds.height };
-
-            if (check_collision(world_collision, hazard_world_collision)) {
-                alive = false;
-
-                break;
-            }
-        }
+        // Only hazards in nearby cells are tested
+        if (hazard->grid.overlaps(world_collision))
+            alive = false;
 
         // Lava
-        std::pair<Vector2, bool> lava_collision = tilemap->get_collision(world_collision, [](Tile_ID id) -> Collision_Type {
-            return (id == lava_mid || id == lava_top ? full : none);
-        });
+        std::pair<Vector2, bool> lava_collision = tilemap->get_collision(world_collision, lava_collision_table);
 
         if (lava_collision.second)
             alive = false;
 
-        // Go through all goals
-        for (auto const &g : goal->get_entities()) {
-            auto const &goal_transform = c.get_component<Component_Transform>(g);
-            auto const &goal_collision = c.get_component<Component_Collision>(g);
-
-            // World space
-            Rectangle goal_world_collision{ goal_transform.position.x + goal_collision.bounds.x, goal_transform.position.y + goal_collision.bounds.y, goal_collision.bounds.width, goal_collision.bounds.height };
-
-            if (check_collision(world_collision, goal_world_collision)) {
-                achieved_goal = true;
-
-                break;
-            }
-        }
+        // Same for goals
+        if (goal->grid.overlaps(world_collision))
+            achieved_goal = true;
 
         // Camera follows the agent
-        gr.camera_position.x = transform.position.x * unit_to_pixels;
-        gr.camera_position.y = (transform.position.y - 0.5f) * unit_to_pixels;
+        gr->camera_position.x = transform.position.x * unit_to_pixels;
+        gr->camera_position.y = (transform.position.y - 0.5f) * unit_to_pixels;
 
         // Animation cycle
         agent.t += agent.rate * dt;
@@ -263,36 +257,36 @@ void System_Agent::render(int theme) {
     assert(entities.size() == 1); // Only one player
 
     for (auto const &e : entities) {
-        auto const &agent = c.get_component<Component_Agent>(e);
-        auto const &transform = c.get_component<Component_Transform>(e);
-        auto const &dynamics = c.get_component<Component_Dynamics>(e);
+        auto const &agent = world->get_component<Component_Agent>(e);
+        auto const &transform = world->get_component<Component_Transform>(e);
+        auto const &dynamics = world->get_component<Component_Dynamics>(e);
 
         // Select the correct texture
         Asset_Texture* texture;
 
         if (std::abs(dynamics.velocity.x) < 0.01f && agent.on_ground)
-            texture = &stand_textures[theme];
+            texture = stand_textures[theme];
         else if (!agent.on_ground) 
-            texture = &jump_textures[theme];
+            texture = jump_textures[theme];
         else if (agent.t > 0.5f)
-            texture = &walk2_textures[theme];
+            texture = walk2_textures[theme];
         else
-            texture = &walk1_textures[theme];
+            texture = walk1_textures[theme];
 
         Vector2 position{ transform.position.x - 0.5f, transform.position.y - 2.0f };
 
-        gr.render_texture(texture, (Vector2){ position.x * unit_to_pixels, position.y * unit_to_pixels }, unit_to_pixels / texture->width, 1.0f, !agent.face_forward);
+        gr->render_texture(texture, (Vector2){ position.x * unit_to_pixels, position.y * unit_to_pixels }, unit_to_pixels / texture->width, 1.0f, !agent.face_forward);
     }
 }
 
 void System_Particles::init() {
-    particle_texture.load("assets/misc_assets/iconCircle_white.png");
+    particle_texture = &manager_texture.get("assets/misc_assets/iconCircle_white.png");
 }
 
 void System_Particles::update(float dt) {
     for (auto const &e : entities) {
-        auto const &transform = c.get_component<Component_Transform>(e);
-        auto &particles = c.get_component<Component_Particles>(e);
+        auto const &transform = world->get_component<Component_Transform>(e);
+        auto &particles = world->get_component<Component_Particles>(e);
 
         int dead_index = -1;
     
@@ -325,7 +319,7 @@ void System_Particles::render() {
     const float base_scale = 0.45f;
 
     for (auto const &e : entities) {
-        auto const &particles = c.get_component<Component_Particles>(e);
+        auto const &particles = world->get_component<Component_Particles>(e);
 
         for (int i = 0; i < particles.particles.size(); i++) {
             const Particle &p = particles.particles[i];
@@ -339,7 +333,7 @@ void System_Particles::render() {
             float scale = base_scale * (0.4f * life_ratio + 0.6f);
             float offset_y = -life_ratio * 0.17f;
 
-            gr.render_texture(&particle_texture, (Vector2){ p.position.x * unit_to_pixels - 0.5f * particle_texture.width * scale, (p.position.y + offset_y) * unit_to_pixels - 0.5f * particle_texture.height * scale }, scale * unit_to_pixels / particle_texture.width, alpha);
+            gr->render_texture(particle_texture, (Vector2){ p.position.x * unit_to_pixels - 0.5f * particle_texture->width * scale, (p.position.y + offset_y) * unit_to_pixels - 0.5f * particle_texture->height * scale }, scale * unit_to_pixels / particle_texture->width, alpha);
         }
     }
 }
@@ -3,10 +3,14 @@
 #include "common_components.h"
 #include "common_assets.h"
 #include "ecs.h"
+#include "spatial_grid.h"
 
 #include <cmath>
 #include <algorithm>
 
+class System_Tilemap;
+class System_Hazard;
+
 // -------------------- Sprites ---------------------
 //
 // Selector for sprites to render
@@ -22,14 +26,25 @@ private:
     std::vector<std::pair<float, Entity>> render_entities;
 
 public:
+    void init(); // Reserves for every entity, so levels with more sprites don't allocate
+
     void update(float dt);
     void render(Sprite_Render_Mode mode);
+
+    // Whether any sprite sorts behind the tile map
+    bool has_negative_z() const {
+        return !render_entities.empty() && render_entities.front().first < 0.0f;
+    }
 };
 
 // --------------------- Mob AI --------------------
 
 class System_Mob_AI : public System {
 public:
+    // Set on setup
+    System_Tilemap* tilemap = nullptr;
+    System_Hazard* hazard = nullptr; // Mobs are hazards, their grid cells follow them
+
     void update(float dt);
 };
 
@@ -38,7 +53,15 @@ public:
 // Empty mostly, since just need it to collect hazards for agent system
 class System_Hazard : public System {
 public:
-    std::unordered_set<Entity> &get_entities() {
+    // Owns the transform and collision columns, the first group->size entries of each are the hazards
+    Group* group = nullptr;
+
+    // Broadphase for the agent, built on reset and updated as mobs move
+    Spatial_Grid grid;
+
+    void build_grid(int map_width, int map_height);
+
+    Entity_Set &get_entities() {
         return entities;
     }
 };
@@ -48,7 +71,12 @@ public:
 // Empty mostly, since just need it to collect goals for agent system
 class System_Goal : public System {
 public:
-    std::unordered_set<Entity> &get_entities() {
+    // Broadphase for the agent, built on reset
+    Spatial_Grid grid;
+
+    void build_grid(int map_width, int map_height);
+
+    Entity_Set &get_entities() {
         return entities;
     }
 };
@@ -60,16 +88,21 @@ static const std::vector<std::string> agent_themes = { "Beige", "Blue", "Green",
 class System_Agent : public System {
 private:
     // Agent textures
-    std::vector<Asset_Texture> stand_textures;
-    std::vector<Asset_Texture> jump_textures;
-    std::vector<Asset_Texture> walk1_textures;
-    std::vector<Asset_Texture> walk2_textures;
+    std::vector<Asset_Texture*> stand_textures;
+    std::vector<Asset_Texture*> jump_textures;
+    std::vector<Asset_Texture*> walk1_textures;
+    std::vector<Asset_Texture*> walk2_textures;
 
 public:
+    // Set on setup
+    System_Tilemap* tilemap = nullptr;
+    System_Hazard* hazard = nullptr;
+    System_Goal* goal = nullptr;
+
     void init(); // Needs to load sprites
 
     // Returns alive status (false if touched hazard), and whether touched a goal (coin)
-    std::pair<bool, bool> update(float dt, const std::shared_ptr<System_Hazard> &hazard, const std::shared_ptr<System_Goal> &goal, int action);
+    std::pair<bool, bool> update(float dt, int action);
     void render(int theme);
 };
 
@@ -77,7 +110,7 @@ public:
 
 class System_Particles : public System {
 private:
-    Asset_Texture particle_texture;
+    Asset_Texture* particle_texture;
 
 public:
     void init(); // Loads sprites
@@ -1,79 +1,225 @@
 #include "ecs.h"
 
-Entity_Manager::Entity_Manager() {
-    for (Entity e = 0; e < max_entities; e++)
-        available_entities.push(e);
-}
-
 Entity Entity_Manager::create_entity() {
     // Make sure we don't have too many
     assert(num_living_entities < max_entities);
 
-    Entity e = available_entities.front();
-    available_entities.pop();
+    // Reuse destroyed slots first
+    int index = num_free > 0 ? free_slots[--num_free] : num_fresh++;
 
-    entities_in_use.insert(e);
+    // Slots are not touched on clear, reset here
+    signatures[index].reset();
+    generations[index]++;
 
     num_living_entities++;
 
-    return e;
+    return get_entity(index);
 }
 
 void Entity_Manager::destroy_entity(Entity e) {
     // Make sure is a valid entity handle
-    assert(e >= 0 && e < max_entities);
+    assert(in_use(e));
 
-    // Clear signature
-    signatures[e].reset();
+    int index = entity_index(e);
 
-    available_entities.push(e);
+    // Clear signature
+    signatures[index].reset();
 
-    assert(entities_in_use.find(e) != entities_in_use.end());
+    // Invalidate outstanding handles
+    generations[index]++;
 
-    entities_in_use.erase(e);
+    free_slots[num_free++] = index;
 
     num_living_entities--;
 }
 
-void Entity_Manager::clear_entities() {
-    entities_in_use.clear();
+void Entity_Manager::save_state(State_Writer &writer) const {
+    writer.write(num_free);
+    writer.write(num_fresh);
+    writer.write(num_living_entities);
+
+    writer.write(signatures.data(), num_fresh * sizeof(Signature));
+    writer.write(generations);
+    writer.write(free_slots.data(), num_free * sizeof(int));
+}
+
+void Entity_Manager::load_state(State_Reader &reader) {
+    reader.read(num_free);
+    reader.read(num_fresh);
+    reader.read(num_living_entities);
+
+    if (!reader.check(num_fresh >= 0 && num_fresh <= max_entities && num_free >= 0 && num_free <= num_fresh)) {
+        clear_entities();
+
+        return;
+    }
+
+    reader.read(signatures.data(), num_fresh * sizeof(Signature));
+    reader.read(generations);
+    reader.read(free_slots.data(), num_free * sizeof(int));
+
+    for (int i = 0; i < num_free; i++)
+        reader.check(free_slots[i] >= 0 && free_slots[i] < num_fresh);
+
+    // A slot on the free list twice would be handed out twice
+    reader.check(!reader.failed && num_living_entities == num_fresh - num_free && static_cast<int>(get_living_slots().count()) == num_living_entities);
+
+    if (reader.failed)
+        clear_entities();
+}
+
+std::bitset<max_entities> Entity_Manager::get_living_slots() const {
+    std::bitset<max_entities> living;
+
+    for (int i = 0; i < num_fresh; i++)
+        living.set(i);
+
+    for (int i = 0; i < num_free; i++)
+        living.reset(free_slots[i]);
+
+    return living;
+}
+
+int Entity_Manager::count_matching(Signature s, const std::bitset<max_entities> &living) const {
+    int count = 0;
 
-    available_entities = std::queue<Entity>();
+    for (int i = 0; i < num_fresh; i++) {
+        if (living[i] && (signatures[i] & s) == s)
+            count++;
+    }
 
-    for (Entity e = 0; e < max_entities; e++) {
-        signatures[e].reset();
+    return count;
+}
 
-        available_entities.push(e);
+void Component_Manager::save_state(State_Writer &writer) const {
+    for (auto const &component : component_arrays) {
+        if (component != nullptr)
+            component->save_state(writer);
     }
 
-    num_living_entities = 0;
+    for (auto const &group : groups)
+        writer.write(group->size);
+}
+
+void Component_Manager::load_state(State_Reader &reader, const Entity_Manager &entity_manager) {
+    std::bitset<max_entities> living = entity_manager.get_living_slots();
+
+    for (Component_Type type = 0; type < max_components; type++) {
+        auto const &component = component_arrays[type];
+
+        if (component == nullptr)
+            continue;
+
+        component->load_state(reader);
+
+        if (reader.failed)
+            return;
+
+        // Exactly the living entities with the type in their signature, each once
+        Signature s;
+        s.set(type);
+
+        reader.check(component->get_size() == entity_manager.count_matching(s, living));
+
+        for (int i = 0; i < component->get_size() && !reader.failed; i++) {
+            Entity e = component->get_entity(i);
+
+            reader.check(living[entity_index(e)] && entity_manager.in_use(e) && entity_manager.get_signature(e)[type] && component->get_index(e) == i);
+        }
+    }
+
+    for (auto const &group : groups) {
+        reader.read(group->size);
+
+        if (!reader.check(group->size >= 0 && group->size <= group->owned[0]->get_size()))
+            return;
+
+        // Every matching entity is a member, members come first in the same order in all owned arrays
+        reader.check(group->size == entity_manager.count_matching(group->signature, living));
+
+        for (int i = 0; i < group->size && !reader.failed; i++) {
+            Entity e = group->owned[0]->get_entity(i);
+
+            reader.check((entity_manager.get_signature(e) & group->signature) == group->signature);
+
+            for (auto array : group->owned)
+                reader.check(array->get_entity(i) == e);
+        }
+    }
+}
+
+void System_Manager::rebuild_entities(const Entity_Manager &entity_manager, const Component_Manager &component_manager) {
+    Signature owned_types = component_manager.get_owned_types();
+
+    for (int id = 0; id < systems.size(); id++) {
+        auto const &system = systems[id];
+        auto const &system_signature = signatures[id];
+
+        if (system == nullptr)
+            continue;
+
+        system->entities.clear();
+
+        // Sets are filled in the order entities get their components. Walking the array of a required component that no
+        // group rearranges gives back that order, as long as entities only get components when they are created
+        Signature lead_types = (system_signature & ~owned_types).any() ? system_signature & ~owned_types : system_signature;
+
+        if (lead_types.none()) {
+            // Matches everything with a component, in slot order
+            std::bitset<max_entities> living = entity_manager.get_living_slots();
+
+            for (int i = 0; i < max_entities; i++) {
+                if (living[i] && entity_manager.get_signature(entity_manager.get_entity(i)).any())
+                    system->entities.insert(entity_manager.get_entity(i));
+            }
+
+            continue;
+        }
+
+        Component_Type lead = 0;
+
+        while (!lead_types[lead])
+            lead++;
+
+        const Interface_Component_Array* array = component_manager.get_array(lead);
+
+        if (array == nullptr)
+            continue; // Nothing can match
+
+        for (int i = 0; i < array->get_size(); i++) {
+            Entity e = array->get_entity(i);
+
+            if ((entity_manager.get_signature(e) & system_signature) == system_signature)
+                system->entities.insert(e);
+        }
+    }
 }
 
 void System_Manager::entity_destroyed(Entity e) {
     // Erase from all
-    for (auto const &pair : systems) {
-        auto const &system = pair.second;
-
-        system->entities.erase(e);
+    for (auto const &system : systems) {
+        if (system != nullptr)
+            system->entities.erase(e);
     }
 }
 
 void System_Manager::clear_entities() {
     // Erase from all
-    for (auto const &pair : systems) {
-        auto const &system = pair.second;
-
-        system->entities.clear();
+    for (auto const &system : systems) {
+        if (system != nullptr)
+            system->entities.clear();
     }
 }
 
 void System_Manager::entity_signature_changed(Entity e, Signature s) {
     // Notify all
-    for (auto const &pair : systems) {
-        auto const &id = pair.first;
-        auto const &system = pair.second;
+    for (int id = 0; id < systems.size(); id++) {
+        auto const &system = systems[id];
         auto const &system_signature = signatures[id];
 
+        if (system == nullptr)
+            continue;
+
         // If signature matches, insert into set
         if ((s & system_signature) == system_signature)
             system->entities.insert(e);
@@ -82,16 +228,32 @@ void System_Manager::entity_signature_changed(Entity e, Signature s) {
     }
 }
 
-void Coordinator::destroy_entity(Entity e) {
+void World::destroy_entity(Entity e) {
     entity_manager.destroy_entity(e);
     component_manager.entity_destroyed(e);
     system_manager.entity_destroyed(e);
 }
 
-void Coordinator::clear_entities() {
+void World::clear_entities() {
     entity_manager.clear_entities();
     component_manager.clear_entities();
     system_manager.clear_entities();
 }
 
-Coordinator c;
+void World::save_state(State_Writer &writer) const {
+    entity_manager.save_state(writer);
+    component_manager.save_state(writer);
+}
+
+void World::load_state(State_Reader &reader) {
+    entity_manager.load_state(reader);
+    component_manager.load_state(reader, entity_manager);
+
+    if (reader.failed) {
+        clear_entities();
+
+        return;
+    }
+
+    system_manager.rebuild_entities(entity_manager, component_manager);
+}
@@ -1,63 +1,187 @@
 #pragma once
 
 #include <array>
+#include <vector>
 #include <bitset>
-#include <queue>
+#include <atomic>
 #include <memory>
-#include <unordered_map>
-#include <unordered_set>
+#include <utility>
+#include <cstdint>
 #include <assert.h>
 
+#include "state.h"
+
 // ECS based on https://austinmorlan.com/posts/entity_component_system/
 
-// Handles and types
-typedef int Entity;
+// Handles and types. An entity handle is a slot index in the low bits and the slot generation in the high bits,
+// so handles to destroyed (or cleared) entities never match the entity that reuses the slot
+typedef uint32_t Entity;
 typedef int Component_Type;
 
 // Limits
 const int max_entities = 1000;
 const int max_components = 16;
 
+// Index and generation get 16 bits each, generations wrap around
+const int entity_index_bits = 16;
+
+static_assert(max_entities <= (1 << entity_index_bits), "Entity index does not fit the handle");
+
+inline int entity_index(Entity e) {
+    return e & ((1u << entity_index_bits) - 1);
+}
+
+inline uint32_t entity_generation(Entity e) {
+    return e >> entity_index_bits;
+}
+
 // Bitset that tells us which components an entity has
 typedef std::bitset<max_components> Signature;
 
+// Process wide type ids, each type gets the next free id the first time it is asked for.
+// Registration asks in the same order for every instance, so ids (and signatures) match across instances
+template<typename Family>
+int next_type_id() {
+    static std::atomic<int> next{ 0 };
+
+    return next++;
+}
+
+template<typename Family, typename T>
+int type_id() {
+    static const int id = next_type_id<Family>();
+
+    return id;
+}
+
+struct Component_Family {};
+struct System_Family {};
+
+template<typename T>
+Component_Type component_type_id() {
+    return type_id<Component_Family, T>();
+}
+
+// Slots are handed out from a flat free list first, then from the never used tail [num_fresh, max_entities).
+// Clearing only resets the counters, a slot gets its signature reset and generation bumped when it is handed out again
 class Entity_Manager {
 private:
-    std::queue<Entity> available_entities;
-    std::unordered_set<Entity> entities_in_use;
-
     std::array<Signature, max_entities> signatures;
+    std::array<uint16_t, max_entities> generations{};
+
+    std::array<int, max_entities> free_slots;
+    int num_free = 0;
+    int num_fresh = 0;
 
     int num_living_entities = 0;
 
 public:
-    Entity_Manager();
-
     Entity create_entity();
 
     void destroy_entity(Entity e);
 
     void set_signature(Entity e, Signature s) {
-        assert(e >= 0 && e < max_entities);
+        assert(in_use(e));
         
-        signatures[e] = s;
+        signatures[entity_index(e)] = s;
     }
 
     Signature get_signature(Entity e) const {
-        assert(e >= 0 && e < max_entities);
+        assert(in_use(e));
 
-        return signatures[e];
+        return signatures[entity_index(e)];
     }
 
-    bool in_use(Entity e) {
-        return entities_in_use.find(e) != entities_in_use.end();
+    bool in_use(Entity e) const {
+        int index = entity_index(e);
+
+        // Freed slots have had their generation bumped, so only the free list tail needs a range check
+        return index < num_fresh && generations[index] == entity_generation(e);
     };
 
     int get_num_living_entities() const {
         return num_living_entities;
     }
 
-    void clear_entities();
+    // Current handle of a slot
+    Entity get_entity(int index) const {
+        return (static_cast<Entity>(generations[index]) << entity_index_bits) | index;
+    }
+
+    // Handed out slots minus the free list
+    std::bitset<max_entities> get_living_slots() const;
+
+    // Living entities whose signature contains s
+    int count_matching(Signature s, const std::bitset<max_entities> &living) const;
+
+    void clear_entities() {
+        num_free = 0;
+        num_fresh = 0;
+        num_living_entities = 0;
+    }
+
+    // All generations are kept so restored worlds hand out the same handles. Loading checks the free list and counts
+    void save_state(State_Writer &writer) const;
+    void load_state(State_Reader &reader);
+};
+
+// Sparse set of entity handles, constant time insert, erase and clear. Iterates the packed handles in insertion order
+// (until an erase moves the last one into the hole)
+class Entity_Set {
+private:
+    std::array<int, max_entities> sparse{};
+    std::array<Entity, max_entities> dense{};
+
+    int count = 0;
+
+public:
+    bool contains(Entity e) const {
+        int index = sparse[entity_index(e)];
+
+        return index < count && dense[index] == e;
+    }
+
+    void insert(Entity e) {
+        if (contains(e))
+            return;
+
+        sparse[entity_index(e)] = count;
+        dense[count] = e;
+
+        count++;
+    }
+
+    void erase(Entity e) {
+        if (!contains(e))
+            return;
+
+        int index = sparse[entity_index(e)];
+
+        count--;
+
+        dense[index] = dense[count];
+        sparse[entity_index(dense[index])] = index;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const Entity* begin() const {
+        return dense.data();
+    }
+
+    const Entity* end() const {
+        return dense.data() + count;
+    }
 };
 
 class Interface_Component_Array {
@@ -65,119 +189,218 @@ public:
     virtual ~Interface_Component_Array() = default;
     virtual void entity_destroyed(Entity e) = 0;
     virtual void clear_entities() = 0;
+
+    // Used by groups to arrange the dense order
+    virtual bool contains(Entity e) const = 0;
+    virtual int get_index(Entity e) const = 0;
+    virtual void swap(int index_a, int index_b) = 0;
+
+    // Dense iteration
+    virtual int get_size() const = 0;
+    virtual Entity get_entity(int index) const = 0;
+
+    virtual void save_state(State_Writer &writer) const = 0;
+    virtual void load_state(State_Reader &reader) = 0;
 };
 
+// Sparse set: entity_to_index is indexed by entity slot, components and index_to_entity are packed in the first size slots.
+// An entity is in the set when its index points back at it, so stale entity_to_index entries never need clearing
 template<typename T>
-class Component_Array : public Interface_Component_Array {
+class Component_Array final : public Interface_Component_Array {
+    static_assert(std::is_trivially_copyable<T>::value, "Components are plain data, snapshots copy them as bytes");
+
 private:
     std::array<T, max_entities> components;
 
-    std::unordered_map<Entity, int> entity_to_index;
-    std::unordered_map<int, Entity> index_to_entity;
+    std::array<int, max_entities> entity_to_index{};
+    std::array<Entity, max_entities> index_to_entity{};
 
     int size = 0;
 
 public:
+    bool contains(Entity e) const override {
+        int index = entity_to_index[entity_index(e)];
+
+        return index < size && index_to_entity[index] == e;
+    }
+
     void insert(Entity e, T component) {
         // Make sure doesn't already exist
-        assert(entity_to_index.find(e) == entity_to_index.end());
-
-        int new_index = size;
+        assert(!contains(e));
 
-        entity_to_index[e] = new_index;
-        index_to_entity[new_index] = e;
-        components[new_index] = component;
+        entity_to_index[entity_index(e)] = size;
+        index_to_entity[size] = e;
+        components[size] = std::move(component);
 
         size++;
     }
 
     void remove(Entity e) {
         // Make sure exists
-        assert(entity_to_index.find(e) != entity_to_index.end());
+        assert(contains(e));
 
-        // Maintain density
-        int index_removed = entity_to_index[e];
+        // Maintain density by moving the last element into the hole
+        int index_removed = entity_to_index[entity_index(e)];
         int index_last = size - 1;
 
-        components[index_removed] = components[index_last];
-
-        // Update mappings
         Entity e_last = index_to_entity[index_last];
-        entity_to_index[e_last] = index_removed;
-        index_to_entity[index_removed] = e_last;
 
-        entity_to_index.erase(e);
-        index_to_entity.erase(index_last);
+        components[index_removed] = std::move(components[index_last]);
+        index_to_entity[index_removed] = e_last;
+        entity_to_index[entity_index(e_last)] = index_removed;
 
         size--;
     }
 
     T &get(Entity e) {
         // Make sure exists
-        assert(entity_to_index.find(e) != entity_to_index.end());
+        assert(contains(e));
+
+        return components[entity_to_index[entity_index(e)]];
+    }
+
+    // Dense iteration, index i holds the component of get_entity(i)
+    int get_size() const override {
+        return size;
+    }
+
+    T* get_data() {
+        return components.data();
+    }
+
+    Entity get_entity(int index) const override {
+        return index_to_entity[index];
+    }
+
+    int get_index(Entity e) const override {
+        assert(contains(e));
 
-        return components[entity_to_index[e]];
+        return entity_to_index[entity_index(e)];
+    }
+
+    // Exchange two dense slots, entities keep their components
+    void swap(int index_a, int index_b) override {
+        if (index_a == index_b)
+            return;
+
+        std::swap(components[index_a], components[index_b]);
+
+        Entity e_a = index_to_entity[index_a];
+        Entity e_b = index_to_entity[index_b];
+
+        index_to_entity[index_a] = e_b;
+        index_to_entity[index_b] = e_a;
+        entity_to_index[entity_index(e_a)] = index_b;
+        entity_to_index[entity_index(e_b)] = index_a;
     }
     
     // Inherited
     void entity_destroyed(Entity e) override {
         // Remove if exists
-        if (entity_to_index.find(e) != entity_to_index.end())
+        if (contains(e))
             remove(e);
     }
 
     void clear_entities() override {
-        entity_to_index.clear();
-        index_to_entity.clear();
-
         size = 0;
     }
+
+    // Only the packed part, entity_to_index is rebuilt from it
+    void save_state(State_Writer &writer) const override {
+        writer.write(size);
+        writer.write(index_to_entity.data(), size * sizeof(Entity));
+        writer.write(components.data(), size * sizeof(T));
+    }
+
+    void load_state(State_Reader &reader) override {
+        reader.read(size);
+
+        if (!reader.check(size >= 0 && size <= max_entities)) {
+            size = 0;
+
+            return;
+        }
+
+        reader.read(index_to_entity.data(), size * sizeof(Entity));
+        reader.read(components.data(), size * sizeof(T));
+
+        for (int i = 0; i < size && reader.check(entity_index(index_to_entity[i]) < max_entities); i++)
+            entity_to_index[entity_index(index_to_entity[i])] = i;
+    }
+};
+
+// Owning group (as in EnTT). Entities whose signature contains the group signature are kept packed at the front of
+// the owned component arrays in the same order, so slot i of every owned array belongs to the same member and systems
+// can walk the owned components as plain columns
+class Group {
+public:
+    Signature signature;
+    std::vector<Interface_Component_Array*> owned;
+
+    int size = 0;
+
+    bool contains(Entity e) const {
+        return owned[0]->contains(e) && owned[0]->get_index(e) < size;
+    }
+
+    void entity_signature_changed(Entity e, Signature s) {
+        bool member = contains(e);
+        bool matches = (s & signature) == signature;
+
+        if (matches && !member) {
+            // Swap into the first slot after the members
+            for (auto array : owned)
+                array->swap(array->get_index(e), size);
+
+            size++;
+        }
+        else if (!matches && member) {
+            // Swap into the last member slot, which then falls outside
+            size--;
+
+            for (auto array : owned)
+                array->swap(array->get_index(e), size);
+        }
+    }
 };
 
 class Component_Manager {
 private:
-    std::unordered_map<size_t, Component_Type> component_types;
-    std::unordered_map<size_t, std::shared_ptr<Interface_Component_Array>> component_arrays;
+    // Indexed by component type id
+    std::array<std::unique_ptr<Interface_Component_Array>, max_components> component_arrays;
 
-    Component_Type next_component_type = 0;
+    std::vector<std::unique_ptr<Group>> groups;
+    Signature owned_types; // Each array can be arranged by one group only
 
     template<typename T>
-    std::shared_ptr<Component_Array<T>> get_component_array() {
-        size_t id = typeid(T).hash_code();
+    Component_Array<T>* get_component_array() {
+        Component_Type type = component_type_id<T>();
 
         // Make sure component is registered
-        assert(component_types.find(id) != component_types.end());
+        assert(type < max_components && component_arrays[type] != nullptr);
 
-        return std::static_pointer_cast<Component_Array<T>>(component_arrays[id]);
+        return static_cast<Component_Array<T>*>(component_arrays[type].get());
     }
 
 public:
     template<typename T>
     void register_component() {
-        size_t id = typeid(T).hash_code();
-
-        // Make sure not already registered
-        assert(component_types.find(id) == component_types.end());
+        Component_Type type = component_type_id<T>();
 
-        component_types[id] = next_component_type;
-        component_arrays[id] = std::make_shared<Component_Array<T>>();
+        // Make sure there is room and not already registered
+        assert(type < max_components && component_arrays[type] == nullptr);
 
-        next_component_type++;
+        component_arrays[type] = std::make_unique<Component_Array<T>>();
     }
 
     template<typename T>
     Component_Type get_component_type() {
-        size_t id = typeid(T).hash_code();
-
-        // Make sure exists
-        assert(component_types.find(id) != component_types.end());
-
-        return component_types[id];
+        return component_type_id<T>();
     }
 
     template<typename T>
     void add_component(Entity e, T component) {
-        get_component_array<T>()->insert(e, component);
+        get_component_array<T>()->insert(e, std::move(component));
     }
 
     template<typename T>
@@ -190,77 +413,144 @@ public:
         return get_component_array<T>()->get(e);
     }
 
+    // Packed components, the first size entries of arrays owned by a group are its members in group order
+    template<typename T>
+    T* get_component_data() {
+        return get_component_array<T>()->get_data();
+    }
+
+    template<typename T>
+    Entity get_component_entity(int index) {
+        return get_component_array<T>()->get_entity(index);
+    }
+
+    // Signature must include the owned components
+    template<typename... Owned>
+    Group* create_group(Signature signature) {
+        auto group = std::make_unique<Group>();
+
+        group->signature = signature;
+        group->owned = { get_component_array<Owned>()... };
+
+        for (Component_Type type : { component_type_id<Owned>()... }) {
+            assert(signature[type] && !owned_types[type]);
+
+            owned_types.set(type);
+        }
+
+        groups.push_back(std::move(group));
+
+        return groups.back().get();
+    }
+
+    // Must be called while the entity still has the components it is about to lose
+    void entity_signature_changed(Entity e, Signature s) {
+        for (auto const &group : groups)
+            group->entity_signature_changed(e, s);
+    }
+
     void entity_destroyed(Entity e) {
-        // Notify all
-        for (auto const &pair : component_arrays) {
-            auto const &component = pair.second;
+        // Leave groups first, removal reorders the dense arrays
+        entity_signature_changed(e, Signature());
 
-            component->entity_destroyed(e);
+        // Notify all
+        for (auto const &component : component_arrays) {
+            if (component != nullptr)
+                component->entity_destroyed(e);
         }
     }
 
     void clear_entities() {
         // Notify all
-        for (auto const &pair : component_arrays) {
-            auto const &component = pair.second;
-
-            component->clear_entities();
+        for (auto const &component : component_arrays) {
+            if (component != nullptr)
+                component->clear_entities();
         }
+
+        for (auto const &group : groups)
+            group->size = 0;
+    }
+
+    // Loading checks the arrays and groups against the (already loaded) entity signatures
+    void save_state(State_Writer &writer) const;
+    void load_state(State_Reader &reader, const Entity_Manager &entity_manager);
+
+    // Nullptr if the type is not registered
+    const Interface_Component_Array* get_array(Component_Type type) const {
+        return component_arrays[type].get();
+    }
+
+    Signature get_owned_types() const {
+        return owned_types;
     }
 };
 
+class World;
+
 class System {
 public:
-    std::unordered_set<Entity> entities;
+    World* world = nullptr; // Set when registered
+
+    Entity_Set entities;
 };
 
 class System_Manager {
 private:
-    std::unordered_map<size_t, Signature> signatures;
-    std::unordered_map<size_t, std::shared_ptr<System>> systems;
+    // Indexed by system type id, nullptr for types not registered with this manager
+    std::vector<Signature> signatures;
+    std::vector<std::shared_ptr<System>> systems;
 
 public:
     template<typename T>
     std::shared_ptr<T> register_system() {
-        size_t id = typeid(T).hash_code();
+        int id = type_id<System_Family, T>();
+
+        if (id >= systems.size()) {
+            systems.resize(id + 1);
+            signatures.resize(id + 1);
+        }
 
         // Make sure doesn't already exist
-        assert(systems.find(id) == systems.end());
+        assert(systems[id] == nullptr);
 
         auto system = std::make_shared<T>();
 
-        systems[id] = std::static_pointer_cast<System>(system);
+        systems[id] = system;
         
         return system;
     }
 
     template<typename T>
     void set_signature(Signature s) {
-        size_t id = typeid(T).hash_code();
+        int id = type_id<System_Family, T>();
 
         // Make sure exists
-        assert(systems.find(id) != systems.end());
+        assert(id < systems.size() && systems[id] != nullptr);
 
         signatures[id] = s;
     }
 
     template<typename T>
-    std::shared_ptr<T> get_system() {
-        size_t id = typeid(T).hash_code();
+    T* get_system() {
+        int id = type_id<System_Family, T>();
 
         // Make sure exists
-        assert(systems.find(id) != systems.end());
+        assert(id < systems.size() && systems[id] != nullptr);
 
-        return std::static_pointer_cast<T>(systems[id]);
+        return static_cast<T*>(systems[id].get());
     }
 
     void entity_destroyed(Entity e);
     void clear_entities();
 
     void entity_signature_changed(Entity e, Signature s);
+
+    // Refill the entity sets from the entity signatures, after loading a world
+    void rebuild_entities(const Entity_Manager &entity_manager, const Component_Manager &component_manager);
 };
 
-class Coordinator {
+// Owns everything of one ECS instance, systems reach their world through System::world
+class World {
 public:
     Entity_Manager entity_manager;
     Component_Manager component_manager;
@@ -273,6 +563,11 @@ public:
     void destroy_entity(Entity e);
     void clear_entities();
 
+    // Entities, components and groups, system entity sets are rebuilt on load. Loading needs a world set up the same way
+    // (same components, groups and systems registered), a failed load clears the world
+    void save_state(State_Writer &writer) const;
+    void load_state(State_Reader &reader);
+
     template<typename T>
     void register_component() {
         component_manager.register_component<T>();
@@ -280,21 +575,43 @@ public:
 
     template<typename T>
     void add_component(Entity e, T component) {
-        component_manager.add_component<T>(e, component);
+        component_manager.add_component<T>(e, std::move(component));
 
         auto s = entity_manager.get_signature(e);
         s.set(component_manager.get_component_type<T>(), true);
         entity_manager.set_signature(e, s);
 
+        component_manager.entity_signature_changed(e, s);
+        system_manager.entity_signature_changed(e, s);
+    }
+
+    // Add several components at once, groups and systems see the entity once with its final signature
+    template<typename... T>
+    void add_components(Entity e, T... components) {
+        // Pack expansion inside a braced list runs left to right (C++14, no fold expressions)
+        int expand[] = { 0, (component_manager.add_component<T>(e, std::move(components)), 0)... };
+        (void)expand;
+
+        auto s = entity_manager.get_signature(e);
+
+        for (Component_Type type : { component_manager.get_component_type<T>()... })
+            s.set(type, true);
+
+        entity_manager.set_signature(e, s);
+
+        component_manager.entity_signature_changed(e, s);
         system_manager.entity_signature_changed(e, s);
     }
 
     template<typename T>
     void remove_component(Entity e) {
-        component_manager.remove_component<T>(e);
-
         auto s = entity_manager.get_signature(e);
         s.set(component_manager.get_component_type<T>(), false);
+
+        // Groups let go before the component is removed
+        component_manager.entity_signature_changed(e, s);
+        component_manager.remove_component<T>(e);
+
         entity_manager.set_signature(e, s);
 
         system_manager.entity_signature_changed(e, s);
@@ -310,9 +627,28 @@ public:
         return component_manager.get_component_type<T>();
     }
 
+    template<typename T>
+    T* get_component_data() {
+        return component_manager.get_component_data<T>();
+    }
+
+    template<typename T>
+    Entity get_component_entity(int index) {
+        return component_manager.get_component_entity<T>(index);
+    }
+
+    template<typename... Owned>
+    Group* create_group(Signature signature) {
+        return component_manager.create_group<Owned...>(signature);
+    }
+
     template<typename T>
     std::shared_ptr<T> register_system() {
-        return system_manager.register_system<T>();
+        auto system = system_manager.register_system<T>();
+
+        system->world = this;
+
+        return system;
     }
 
     template<typename T>
@@ -320,5 +656,3 @@ public:
         system_manager.set_signature<T>(s);
     }
 };
-
-extern Coordinator c;
@@ -0,0 +1,125 @@
+#include "level_pack.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char level_pack_magic[8] = { 'C', 'R', 'L', 'E', 'V', 'E', 'L', 'S' };
+
+static uint32_t get_config_flags(const System_Tilemap::Config &config) {
+    return config.easy_mode | (config.allow_pit << 1) | (config.allow_crate << 2) | (config.allow_dy << 3) | (config.allow_mobs << 4);
+}
+
+int Level_Pack::open(const std::string &path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd == -1)
+        return 1;
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(Level_Pack_Header)) {
+        ::close(fd);
+
+        return 1;
+    }
+
+    // The mapping stays valid after closing the file
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (mapped == MAP_FAILED)
+        return 1;
+
+    data = static_cast<const uint8_t*>(mapped);
+    size = st.st_size;
+    header = reinterpret_cast<const Level_Pack_Header*>(data);
+
+    if (std::memcmp(header->magic, level_pack_magic, sizeof(level_pack_magic)) != 0 || header->version != level_pack_version ||
+        header->descriptor_size != sizeof(Level_Descriptor) || header->num_levels < 0 ||
+        size != sizeof(Level_Pack_Header) + static_cast<size_t>(header->num_levels) * sizeof(Level_Descriptor)) {
+        close();
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void Level_Pack::close() {
+    if (data == nullptr)
+        return;
+
+    munmap(const_cast<uint8_t*>(data), size);
+
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+}
+
+System_Tilemap::Config Level_Pack::get_config() const {
+    System_Tilemap::Config config;
+
+    config.easy_mode = header->config_flags & 1;
+    config.allow_pit = (header->config_flags >> 1) & 1;
+    config.allow_crate = (header->config_flags >> 2) & 1;
+    config.allow_dy = (header->config_flags >> 3) & 1;
+    config.allow_mobs = (header->config_flags >> 4) & 1;
+
+    return config;
+}
+
+bool Level_Pack::find(int32_t seed, const System_Tilemap::Config &config, Level_Descriptor &level) const {
+    if (data == nullptr || get_config_flags(config) != header->config_flags)
+        return false;
+
+    int64_t index = static_cast<int64_t>(seed) - header->start_level;
+
+    if (index < 0 || index >= header->num_levels)
+        return false;
+
+    std::memcpy(&level, data + sizeof(Level_Pack_Header) + index * sizeof(Level_Descriptor), sizeof(Level_Descriptor));
+
+    // A corrupt descriptor is generated instead
+    return is_valid_level(level);
+}
+
+int write_level_pack(const std::string &path, int32_t start_level, int32_t num_levels, const System_Tilemap::Config &config) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+
+    if (file == nullptr)
+        return 1;
+
+    Level_Pack_Header header{};
+
+    std::memcpy(header.magic, level_pack_magic, sizeof(level_pack_magic));
+    header.version = level_pack_version;
+    header.descriptor_size = sizeof(Level_Descriptor);
+    header.start_level = start_level;
+    header.num_levels = num_levels;
+    header.config_flags = get_config_flags(config);
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    Level_Descriptor level;
+
+    for (int32_t i = 0; i < num_levels && ok; i++) {
+        // Zeroed so unused spawn slots and padding are the same in every pack
+        std::memset(&level, 0, sizeof(level));
+
+        generate_level(level, start_level + i, config);
+
+        ok = std::fwrite(&level, sizeof(level), 1, file) == 1;
+    }
+
+    ok = std::fclose(file) == 0 && ok;
+
+    return ok ? 0 : 1;
+}
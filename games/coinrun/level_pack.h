@@ -0,0 +1,68 @@
+#pragma once
+
+#include "level_pool.h"
+
+#include <string>
+#include <cstdint>
+
+// Levels are generated offline into a pack (see tools/pack_levels.cpp) and memory mapped, so every process shares one
+// copy through the page cache. Native byte order, a pack is only read on the kind of machine that wrote it
+const uint32_t level_pack_version = 1; // Bump when generation or Level_Descriptor changes
+
+struct Level_Pack_Header {
+    char magic[8]; // "CRLEVELS"
+    uint32_t version;
+    uint32_t descriptor_size; // sizeof(Level_Descriptor) of the writer
+
+    // Level i was generated from seed start_level + i
+    int32_t start_level;
+    int32_t num_levels;
+
+    uint32_t config_flags; // System_Tilemap::Config the levels were generated with
+
+    uint8_t padding[36]; // Descriptors start 64 bytes in, aligned
+};
+
+static_assert(sizeof(Level_Pack_Header) == 64, "Pack header is 64 bytes");
+
+// Read-only view of a mapped pack
+class Level_Pack {
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    const Level_Pack_Header* header = nullptr;
+
+public:
+    Level_Pack() = default;
+    Level_Pack(const Level_Pack &other) = delete;
+    Level_Pack &operator=(const Level_Pack &other) = delete;
+
+    // Returns 0 on success, nonzero if the file is missing or not a pack of this version
+    int open(const std::string &path);
+    void close();
+
+    bool is_open() const {
+        return data != nullptr;
+    }
+
+    int32_t get_start_level() const {
+        return header->start_level;
+    }
+
+    int32_t get_num_levels() const {
+        return header->num_levels;
+    }
+
+    System_Tilemap::Config get_config() const;
+
+    // Copies the level generated from seed into level, returns whether the pack has it and it is valid
+    bool find(int32_t seed, const System_Tilemap::Config &config, Level_Descriptor &level) const;
+
+    ~Level_Pack() {
+        close();
+    }
+};
+
+// Generate levels [start_level, start_level + num_levels) into a pack at path. Returns 0 on success
+int write_level_pack(const std::string &path, int32_t start_level, int32_t num_levels, const System_Tilemap::Config &config);
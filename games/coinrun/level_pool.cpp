@@ -0,0 +1,355 @@
+#include "level_pool.h"
+#include "level_pack.h"
+
+#include <cassert>
+#include <algorithm>
+#include <thread>
+
+void Level_Cache::init(int capacity) {
+    entries.resize(capacity);
+    buckets.assign(capacity * 2, -1);
+
+    num_entries = 0;
+    lru_head = -1;
+    lru_tail = -1;
+}
+
+void Level_Cache::unlink(int index) {
+    Entry &entry = entries[index];
+
+    if (entry.prev != -1)
+        entries[entry.prev].next = entry.next;
+    else
+        lru_head = entry.next;
+
+    if (entry.next != -1)
+        entries[entry.next].prev = entry.prev;
+    else
+        lru_tail = entry.prev;
+}
+
+void Level_Cache::link_front(int index) {
+    Entry &entry = entries[index];
+
+    entry.prev = -1;
+    entry.next = lru_head;
+
+    if (lru_head != -1)
+        entries[lru_head].prev = index;
+    else
+        lru_tail = index;
+
+    lru_head = index;
+}
+
+bool Level_Cache::find(int32_t seed, const System_Tilemap::Config &config, Level_Descriptor &level) {
+    if (entries.empty())
+        return false;
+
+    for (int index = buckets[get_bucket(seed)]; index != -1; index = entries[index].next_in_bucket) {
+        Entry &entry = entries[index];
+
+        if (entry.seed == seed && entry.config == config) {
+            level = entry.level;
+
+            unlink(index);
+            link_front(index);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Level_Cache::insert(int32_t seed, const System_Tilemap::Config &config, const Level_Descriptor &level) {
+    if (entries.empty())
+        return;
+
+    int index;
+
+    if (num_entries < entries.size())
+        index = num_entries++;
+    else {
+        // Evict the least recently used, it has to be taken out of its bucket too
+        index = lru_tail;
+
+        unlink(index);
+
+        int* link = &buckets[get_bucket(entries[index].seed)];
+
+        while (*link != index)
+            link = &entries[*link].next_in_bucket;
+
+        *link = entries[index].next_in_bucket;
+    }
+
+    Entry &entry = entries[index];
+
+    entry.seed = seed;
+    entry.config = config;
+    entry.level = level;
+
+    int bucket = get_bucket(seed);
+
+    entry.next_in_bucket = buckets[bucket];
+    buckets[bucket] = index;
+
+    link_front(index);
+}
+
+void generate_level(Level_Descriptor &level, int32_t seed, const System_Tilemap::Config &config) {
+    std::mt19937 rng(seed);
+
+    generate_level(level, rng, config);
+}
+
+// The one background thread that generates ahead for all pools, so a batch of envs does not start a thread each.
+// Visits the pools with room in turn, one level at a time
+class Level_Generator {
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable work;
+
+    std::vector<Level_Pool*> pools;
+    int next = 0;
+
+    bool stopping = false;
+
+    void loop();
+
+public:
+    static Level_Generator &get() {
+        static Level_Generator generator;
+
+        return generator;
+    }
+
+    void add(Level_Pool* pool);
+
+    // The pool may still have a level claimed afterwards
+    void remove(Level_Pool* pool);
+
+    // A pool may have room again
+    void notify();
+
+    ~Level_Generator();
+};
+
+void Level_Generator::loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!stopping) {
+        Level_Pool* pool = nullptr;
+
+        for (int i = 0; i < pools.size(); i++) {
+            int index = (next + i) % pools.size();
+
+            if (pools[index]->claim()) {
+                pool = pools[index];
+                next = index + 1;
+
+                break;
+            }
+        }
+
+        // Pools notify under the mutex after making room, so none is missed between the scan and the wait
+        if (pool == nullptr) {
+            work.wait(lock);
+
+            continue;
+        }
+
+        lock.unlock();
+
+        pool->fill();
+
+        lock.lock();
+    }
+}
+
+void Level_Generator::add(Level_Pool* pool) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    pools.push_back(pool);
+
+    if (!thread.joinable())
+        thread = std::thread(&Level_Generator::loop, this);
+
+    work.notify_one();
+}
+
+void Level_Generator::remove(Level_Pool* pool) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    pools.erase(std::find(pools.begin(), pools.end(), pool));
+
+    next = 0;
+}
+
+void Level_Generator::notify() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    work.notify_one();
+}
+
+Level_Generator::~Level_Generator() {
+    if (!thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        stopping = true;
+    }
+
+    work.notify_one();
+
+    thread.join();
+}
+
+void Level_Pool::init(const Settings &settings, unsigned int seed) {
+    assert(ring.empty()); // Only once
+
+    this->settings = settings;
+
+    rng.seed(seed);
+    acquired_rng = rng;
+
+    // Small levels, but keep a bound for large level counts
+    int cache_size = settings.cache_size >= 0 ? settings.cache_size : std::min(settings.num_levels, 256);
+
+    cache.init(settings.num_levels > 0 ? cache_size : 0);
+
+    if (settings.pregenerate <= 0)
+        return;
+
+    ring.resize(settings.pregenerate);
+
+    Level_Generator::get().add(this);
+}
+
+void Level_Pool::produce(Level_Descriptor &level) {
+    if (settings.num_levels <= 0) {
+        generate_level(level, rng, settings.config);
+
+        return;
+    }
+
+    std::uniform_int_distribution<int> level_dist(0, settings.num_levels - 1);
+
+    int32_t level_seed = settings.start_level + level_dist(rng);
+
+    if (settings.pack != nullptr && settings.pack->find(level_seed, settings.config, level))
+        return;
+
+    if (cache.find(level_seed, settings.config, level))
+        return;
+
+    generate_level(level, level_seed, settings.config);
+
+    cache.insert(level_seed, settings.config, level);
+}
+
+bool Level_Pool::claim() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (generating || count == ring.size())
+        return false;
+
+    generating = true;
+
+    return true;
+}
+
+void Level_Pool::fill() {
+    // Generate without holding the lock, set_rng waits for this to finish before touching the RNG
+    produce(staging);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    generating = false;
+
+    Ready_Level &ready = ring[(head + count) % ring.size()];
+
+    ready.level = staging;
+    ready.rng = rng;
+
+    count++;
+
+    level_ready.notify_all();
+}
+
+void Level_Pool::seed(unsigned int seed) {
+    std::mt19937 state(seed);
+
+    set_rng(state);
+}
+
+void Level_Pool::set_rng(const std::mt19937 &state) {
+    if (ring.empty()) {
+        rng = state;
+
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        level_ready.wait(lock, [this] { return !generating; });
+
+        rng = state;
+        acquired_rng = state;
+
+        head = 0;
+        count = 0;
+    }
+
+    Level_Generator::get().notify();
+}
+
+void Level_Pool::acquire(Level_Descriptor &level) {
+    if (ring.empty()) {
+        produce(level);
+
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // The background thread is shared with other pools, rather than wait for it generate the next level here
+        if (count == 0 && !generating) {
+            generating = true;
+
+            lock.unlock();
+
+            fill();
+
+            lock.lock();
+        }
+
+        level_ready.wait(lock, [this] { return count > 0; });
+
+        level = ring[head].level;
+        acquired_rng = ring[head].rng;
+
+        head = (head + 1) % ring.size();
+        count--;
+    }
+
+    Level_Generator::get().notify();
+}
+
+Level_Pool::~Level_Pool() {
+    if (ring.empty())
+        return;
+
+    Level_Generator::get().remove(this);
+
+    // The background thread may still be generating for this pool
+    std::unique_lock<std::mutex> lock(mutex);
+
+    level_ready.wait(lock, [this] { return !generating; });
+}
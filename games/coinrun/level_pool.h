@@ -0,0 +1,155 @@
+#pragma once
+
+#include "tilemap.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <vector>
+#include <type_traits>
+
+// Everything a reset needs to set up a level
+struct Level_Descriptor {
+    System_Tilemap::Layout layout;
+
+    int background_index;
+    float background_offset_x;
+
+    int agent_theme;
+    int map_theme;
+};
+
+static_assert(std::is_trivially_copyable<Level_Descriptor>::value, "Levels are cached and copied as plain bytes");
+
+// The game's level generator, defined in coinrun.cpp. Pools and packs both generate through it
+void generate_level(Level_Descriptor &level, std::mt19937 &rng, const System_Tilemap::Config &config);
+
+// Level of a fixed level set, a pure function of the seed and config
+void generate_level(Level_Descriptor &level, int32_t seed, const System_Tilemap::Config &config);
+
+// Whether a level read from outside the generator (a pack) is safe to install, also defined in coinrun.cpp
+bool is_valid_level(const Level_Descriptor &level);
+
+class Level_Pack;
+class Level_Generator;
+
+// Least recently used levels by seed and config. Entries are allocated up front, lookups and inserts never allocate
+class Level_Cache {
+private:
+    struct Entry {
+        int32_t seed;
+        System_Tilemap::Config config;
+
+        int next_in_bucket; // -1 at the end of the bucket
+
+        // Use order, most recent first
+        int prev;
+        int next;
+
+        Level_Descriptor level;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<int> buckets; // First entry of each bucket, -1 if empty
+
+    int num_entries = 0;
+
+    int lru_head = -1;
+    int lru_tail = -1;
+
+    int get_bucket(int32_t seed) const {
+        return (static_cast<uint32_t>(seed) * 2654435761u) % buckets.size();
+    }
+
+    void unlink(int index);
+    void link_front(int index);
+
+public:
+    // Capacity 0 disables caching
+    void init(int capacity);
+
+    // Copies a cached level into level and marks it used, returns whether there was one
+    bool find(int32_t seed, const System_Tilemap::Config &config, Level_Descriptor &level);
+
+    // Replaces the least recently used level when full
+    void insert(int32_t seed, const System_Tilemap::Config &config, const Level_Descriptor &level);
+
+    int get_capacity() const {
+        return entries.size();
+    }
+};
+
+// Generates levels ahead of time, so a reset only installs a ready descriptor. One background thread fills the pools of
+// every instance in the process, and acquire generates the next level itself if that thread has not gotten to it yet.
+// Levels come out of one RNG in order, the sequence is the same as generating them on demand.
+// With a fixed number of levels that RNG only picks level seeds, and each level is a pure function of its seed and the config
+class Level_Pool {
+public:
+    struct Settings {
+        int pregenerate = 0; // Ready levels to keep per pool, 0 generates them in acquire. All pools share one background thread
+
+        // Levels are seeded from [start_level, start_level + num_levels), 0 levels is an endless stream
+        int num_levels = 0;
+        int start_level = 0;
+
+        int cache_size = -1; // Levels kept by seed, -1 picks from num_levels
+
+        const Level_Pack* pack = nullptr; // Looked up before the cache, has to outlive the pool
+
+        System_Tilemap::Config config;
+    };
+
+private:
+    Settings settings;
+
+    std::mt19937 rng; // Only touched by whoever is generating, as is the cache
+
+    Level_Cache cache;
+
+    // A generated level and the RNG state right after it
+    struct Ready_Level {
+        Level_Descriptor level;
+        std::mt19937 rng;
+    };
+
+    // Ready levels, count of them starting at head
+    std::vector<Ready_Level> ring;
+    int head = 0;
+    int count = 0;
+
+    std::mt19937 acquired_rng; // State after the last acquired level, when generating ahead
+
+    Level_Descriptor staging; // Being generated, copied into the ring when done
+
+    std::mutex mutex;
+    std::condition_variable level_ready;
+
+    bool generating = false; // The next level is claimed, by the background thread or acquire
+
+    // Next level of the sequence
+    void produce(Level_Descriptor &level);
+
+    // Claims the next level if there is room for it, the claimer then has to fill
+    bool claim();
+    void fill();
+
+    friend class Level_Generator;
+
+public:
+    void init(const Settings &settings, unsigned int seed);
+
+    // Drops the ready levels and restarts the sequence from seed. Cached levels stay valid
+    void seed(unsigned int seed);
+
+    // Copies the next level into level. Waits if it is still being generated
+    void acquire(Level_Descriptor &level);
+
+    // RNG state after the last acquired level, setting it continues the sequence from there (dropping the ready levels)
+    const std::mt19937 &get_rng() const {
+        return ring.empty() ? rng : acquired_rng;
+    }
+
+    void set_rng(const std::mt19937 &state);
+
+    ~Level_Pool();
+};
@@ -0,0 +1,287 @@
+#include "rasterizer.h"
+
+#include <vector>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Per-thread scratch rows, grown once and reused by every blit
+struct Raster_Scratch {
+    std::vector<int> columns;
+
+    std::vector<uint8_t> texels; // One row of fetched texels
+    std::vector<uint8_t> rgb; // Premultiplied colors, 3 bytes per pixel
+    std::vector<uint8_t> inverse_alpha; // Inverse alpha repeated for each of the 3 bytes
+};
+
+thread_local Raster_Scratch scratch;
+
+// x * y / 255 rounded, identical for the scalar and vector paths
+inline uint8_t mul_div_255(int x, int y) {
+    int t = x * y + 128;
+
+    return (t + (t >> 8)) >> 8;
+}
+
+// dst = src + dst * inverse_alpha / 255 over size bytes
+void blend_bytes(uint8_t* dst, const uint8_t* src, const uint8_t* inverse_alpha, int size) {
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256i round = _mm256_set1_epi16(128);
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inverse_alpha + i));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(d)), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a))), round);
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(d, 1)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1))), round);
+
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+        // packus interleaves the 128 bit lanes, undo that
+        __m256i scaled = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_adds_epu8(s, scaled));
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round_128 = _mm_set1_epi16(128);
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inverse_alpha + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(a, zero)), round_128);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(a, zero)), round_128);
+
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t d = vld1q_u8(dst + i);
+        uint8x16_t a = vld1q_u8(inverse_alpha + i);
+        uint8x16_t s = vld1q_u8(src + i);
+
+        uint16x8_t lo = vmull_u8(vget_low_u8(d), vget_low_u8(a));
+        uint16x8_t hi = vmull_u8(vget_high_u8(d), vget_high_u8(a));
+
+        // (x + ((x + 128) >> 8) + 128) >> 8, same rounding as mul_div_255
+        uint8x16_t scaled = vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)), vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+
+        vst1q_u8(dst + i, vqaddq_u8(s, scaled));
+    }
+#endif
+
+    for (; i < size; i++) {
+        int value = src[i] + mul_div_255(dst[i], inverse_alpha[i]);
+
+        dst[i] = value > 255 ? 255 : value;
+    }
+}
+
+void raster_clear(const Render_Target &target, const Color &color) {
+    int size = target.width * target.height * 3;
+
+    if (color.r == color.g && color.g == color.b) {
+        std::memset(target.pixels, color.r, size);
+
+        return;
+    }
+
+    for (int i = 0; i < size; i += 3) {
+        target.pixels[i + 0] = color.r;
+        target.pixels[i + 1] = color.g;
+        target.pixels[i + 2] = color.b;
+    }
+}
+
+void raster_copy(const Render_Target &target, const Render_Target &source, int offset_x, int offset_y) {
+    int x_start = std::max(0, -offset_x);
+    int x_end = std::min(target.width, source.width - offset_x);
+    int y_start = std::max(0, -offset_y);
+    int y_end = std::min(target.height, source.height - offset_y);
+
+    if (x_start >= x_end)
+        return;
+
+    for (int y = y_start; y < y_end; y++)
+        std::memcpy(target.pixels + (y * target.width + x_start) * 3, source.pixels + ((y + offset_y) * source.width + x_start + offset_x) * 3, (x_end - x_start) * 3);
+}
+
+void raster_to_planar(const Render_Target &source, uint8_t* planes) {
+    const int size = source.width * source.height;
+
+    const uint8_t* pixels = source.pixels;
+
+    uint8_t* r = planes;
+    uint8_t* g = planes + size;
+    uint8_t* b = planes + size * 2;
+
+    int i = 0;
+
+#if defined(__SSSE3__)
+    // Shuffle masks picking channel c of 16 pixels out of each of the 3 loaded vectors (0x80 zeroes)
+    struct Masks {
+        __m128i m[3][3];
+
+        Masks() {
+            for (int c = 0; c < 3; c++)
+                for (int k = 0; k < 3; k++) {
+                    alignas(16) uint8_t mask[16];
+
+                    for (int o = 0; o < 16; o++) {
+                        int index = o * 3 + c - k * 16;
+
+                        mask[o] = index >= 0 && index < 16 ? index : 0x80;
+                    }
+
+                    m[c][k] = _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+                }
+        }
+    };
+
+    static const Masks masks;
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i v[3];
+
+        for (int k = 0; k < 3; k++)
+            v[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i * 3 + k * 16));
+
+        __m128i planes_16[3];
+
+        for (int c = 0; c < 3; c++)
+            planes_16[c] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], masks.m[c][0]), _mm_shuffle_epi8(v[1], masks.m[c][1])), _mm_shuffle_epi8(v[2], masks.m[c][2]));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), planes_16[0]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), planes_16[1]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), planes_16[2]);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= size; i += 16) {
+        uint8x16x3_t v = vld3q_u8(pixels + i * 3);
+
+        vst1q_u8(r + i, v.val[0]);
+        vst1q_u8(g + i, v.val[1]);
+        vst1q_u8(b + i, v.val[2]);
+    }
+#endif
+
+    for (; i < size; i++) {
+        r[i] = pixels[i * 3 + 0];
+        g[i] = pixels[i * 3 + 1];
+        b[i] = pixels[i * 3 + 2];
+    }
+}
+
+// Draw one row of fetched texels onto the target
+void compose_row(uint8_t* dst, uint8_t* texels, int count, int alpha, bool opaque) {
+    if (alpha != 255) {
+        for (int i = 0; i < count * 4; i += 4) {
+            texels[i + 0] = mul_div_255(texels[i + 0], alpha);
+            texels[i + 1] = mul_div_255(texels[i + 1], alpha);
+            texels[i + 2] = mul_div_255(texels[i + 2], alpha);
+            texels[i + 3] = 255 - mul_div_255(255 - texels[i + 3], alpha);
+        }
+    }
+    else if (opaque) {
+        for (int i = 0; i < count; i++)
+            std::memcpy(dst + i * 3, texels + i * 4, 3);
+
+        return;
+    }
+
+    // Split into colors and per-byte inverse alpha. Writes 4 bytes per 3, the scratch rows have one byte of slack
+    uint8_t* rgb = scratch.rgb.data();
+    uint8_t* inverse_alpha = scratch.inverse_alpha.data();
+
+    for (int i = 0; i < count; i++) {
+        uint32_t inverse = texels[i * 4 + 3] * 0x01010101u;
+
+        std::memcpy(rgb + i * 3, texels + i * 4, 4);
+        std::memcpy(inverse_alpha + i * 3, &inverse, 4);
+    }
+
+    blend_bytes(dst, rgb, inverse_alpha, count * 3);
+}
+
+// First covered pixel (inclusive) for an edge, pixel centers are at +0.5
+inline int pixel_start(float edge) {
+    return static_cast<int>(std::ceil(edge - 0.5f));
+}
+
+void raster_blit(const Render_Target &target, const Raster_Image &image, const Rectangle &src_rect, const Rectangle &dst_rect, float alpha, bool flip_horizontal) {
+    if (dst_rect.width <= 0.0f || dst_rect.height <= 0.0f || src_rect.width <= 0.0f || src_rect.height <= 0.0f)
+        return;
+
+    int x_start = std::max(0, pixel_start(dst_rect.x));
+    int x_end = std::min(target.width, pixel_start(dst_rect.x + dst_rect.width));
+    int y_start = std::max(0, pixel_start(dst_rect.y));
+    int y_end = std::min(target.height, pixel_start(dst_rect.y + dst_rect.height));
+
+    if (x_start >= x_end || y_start >= y_end)
+        return;
+
+    int count = x_end - x_start;
+
+    int alpha_byte = static_cast<int>(std::min(1.0f, std::max(0.0f, alpha)) * 255.0f + 0.5f);
+
+    if (alpha_byte == 0)
+        return;
+
+    // Sized for a whole target row, so a thread grows its rows once per target instead of whenever it happens to draw a
+    // wider sprite than before (batch workers pick up instances in no fixed order)
+    if (scratch.columns.size() < count) {
+        scratch.columns.resize(target.width);
+        scratch.texels.resize(target.width * 4);
+        scratch.rgb.resize(target.width * 3 + 1);
+        scratch.inverse_alpha.resize(target.width * 3 + 1);
+    }
+
+    float scale_x = src_rect.width / dst_rect.width;
+    float scale_y = src_rect.height / dst_rect.height;
+
+    // Source coordinate of a target pixel center
+    auto source_x = [&](int x) {
+        float offset = (x + 0.5f - dst_rect.x) * scale_x;
+
+        return flip_horizontal ? src_rect.x + src_rect.width - offset : src_rect.x + offset;
+    };
+
+    auto source_y = [&](int y) {
+        return src_rect.y + (y + 0.5f - dst_rect.y) * scale_y;
+    };
+
+    auto clamp_x = [&](int x) { return std::min(image.width - 1, std::max(0, x)); };
+    auto clamp_y = [&](int y) { return std::min(image.height - 1, std::max(0, y)); };
+
+    int* columns = scratch.columns.data();
+    uint8_t* texels = scratch.texels.data();
+
+    const int stride = image.width * 4;
+
+    for (int i = 0; i < count; i++)
+        columns[i] = clamp_x(static_cast<int>(std::floor(source_x(x_start + i)))) * 4;
+
+    for (int y = y_start; y < y_end; y++) {
+        const uint8_t* row = image.texels + clamp_y(static_cast<int>(std::floor(source_y(y)))) * stride;
+
+        for (int i = 0; i < count; i++)
+            std::memcpy(texels + i * 4, row + columns[i], 4);
+
+        compose_row(target.pixels + (y * target.width + x_start) * 3, texels, count, alpha_byte, image.opaque);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+#include "helpers.h"
+
+// Packed RGB8 image the rasterizer draws into
+struct Render_Target {
+    uint8_t* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+};
+
+// Read-only view of texels, 4 bytes each: premultiplied R, G, B followed by the inverse alpha (255 - a).
+// Blending then becomes dst = src + dst * inverse_alpha / 255 for every byte of the RGB8 target
+struct Raster_Image {
+    const uint8_t* texels = nullptr;
+    int width = 0;
+    int height = 0;
+    bool opaque = false; // No texel has alpha < 255, blending can be skipped
+};
+
+void raster_clear(const Render_Target &target, const Color &color);
+
+// Copy the window of an RGB8 image at (offset_x, offset_y) onto the target, pixels outside the source are left as they are
+void raster_copy(const Render_Target &target, const Render_Target &source, int offset_x, int offset_y);
+
+// Split an RGB8 image into three planes (CHW), planes has room for width * height * 3 bytes
+void raster_to_planar(const Render_Target &source, uint8_t* planes);
+
+// Draw src_rect of the image scaled into dst_rect (target pixels, may lie partially outside the target). Samples the nearest
+// texel, textures are pre-filtered to their on-screen sizes
+void raster_blit(const Render_Target &target, const Raster_Image &image, const Rectangle &src_rect, const Rectangle &dst_rect, float alpha = 1.0f, bool flip_horizontal = false);
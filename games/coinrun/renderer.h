@@ -1,31 +1,27 @@
 #pragma once
 
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_image.h>
-
-#include "helpers.h"
+#include "rasterizer.h"
 
 class Asset_Texture;
 
 class Renderer {
 public:
-    bool rendering_obs = false;
-
-    SDL_Renderer* window_renderer = nullptr;
-    SDL_Renderer* obs_renderer = nullptr;
+    // RGB8 image currently drawn into
+    Render_Target target;
 
     // Camera
     Vector2 camera_position{ 0 };
     Vector2 camera_size{ 64, 64 };
     float camera_scale = 1.0f;
 
+    void clear(const Color &color);
+
     void render_texture(Asset_Texture* texture, const Vector2 &position, float scale = 1.0f, float alpha = 1.0f, bool flip_horizontal = false);
 
-    SDL_Renderer* get_renderer() const {
-        return rendering_obs ? obs_renderer : window_renderer;
-    }
+    // Pixel of an image rendered at the current camera scale (top left corner at position in the world) that lands on the top left of the target
+    std::pair<int, int> get_layer_offset(const Vector2 &position) const;
 
     ~Renderer();
 };
 
-extern Renderer gr; // Global renderer
+extern thread_local Renderer* gr; // Renderer of the instance currently being rendered on this thread
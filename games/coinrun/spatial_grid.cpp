@@ -0,0 +1,49 @@
+#include "spatial_grid.h"
+
+void Spatial_Grid::link(int slot, int cell) {
+    Node &node = nodes[slot];
+
+    node.cell = cell;
+    node.prev = -1;
+    node.next = heads[cell];
+
+    if (heads[cell] != -1)
+        nodes[heads[cell]].prev = slot;
+
+    heads[cell] = slot;
+}
+
+void Spatial_Grid::unlink(int slot) {
+    Node &node = nodes[slot];
+
+    if (node.prev != -1)
+        nodes[node.prev].next = node.next;
+    else
+        heads[node.cell] = node.next;
+
+    if (node.next != -1)
+        nodes[node.next].prev = node.prev;
+}
+
+void Spatial_Grid::clear(float world_width, float world_height) {
+    width = std::max(1, static_cast<int>(std::ceil(world_width / cell_size)));
+    height = std::max(1, static_cast<int>(std::ceil(world_height / cell_size)));
+
+    extent = 0.0f;
+
+    heads.assign(width * height, -1);
+}
+
+void Spatial_Grid::insert(Entity e, const Vector2 &position, const Rectangle &bounds) {
+    assert(width != 0); // Needs a clear first
+
+    extent = std::max({ extent, -bounds.x, bounds.x + bounds.width, -bounds.y, bounds.y + bounds.height });
+
+    int slot = entity_index(e);
+
+    nodes[slot].position = position;
+    nodes[slot].bounds = bounds;
+    nodes[slot].handle = e;
+
+    link(slot, get_cell(position));
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "ecs.h"
+#include "helpers.h"
+
+#include <array>
+#include <vector>
+#include <algorithm>
+
+// Uniform grid over entities for overlap queries. Each entity sits in the cell holding its position, queries grow their
+// rectangle by the largest bounds inserted so every entity that could overlap is visited.
+// Cells are intrusive lists over entity slots, so inserting and moving never allocate
+class Spatial_Grid {
+private:
+    // Everything a query reads about an entity, indexed by entity slot
+    struct Node {
+        Vector2 position;
+        Rectangle bounds; // Relative to position
+
+        int cell;
+        int next; // Slot, -1 at the end of the cell list
+        int prev;
+
+        Entity handle;
+    };
+
+    float cell_size;
+
+    int width = 0; // In cells
+    int height = 0;
+
+    float extent = 0.0f; // Furthest any inserted bounds reach from their position
+
+    std::vector<int> heads; // First slot of each cell, -1 if empty
+
+    std::array<Node, max_entities> nodes;
+
+    // Positions outside the grid go to the border cells
+    int get_cell_x(float x) const {
+        return std::min(width - 1, std::max(0, static_cast<int>(std::floor(x / cell_size))));
+    }
+
+    int get_cell_y(float y) const {
+        return std::min(height - 1, std::max(0, static_cast<int>(std::floor(y / cell_size))));
+    }
+
+    int get_cell(const Vector2 &position) const {
+        return get_cell_x(position.x) + get_cell_y(position.y) * width;
+    }
+
+    void link(int slot, int cell);
+    void unlink(int slot);
+
+public:
+    Spatial_Grid(float cell_size = 4.0f)
+    : cell_size(cell_size)
+    {}
+
+    // Remove everything and cover an area of world_width by world_height units
+    void clear(float world_width, float world_height);
+
+    // Bounds are relative to position
+    void insert(Entity e, const Vector2 &position, const Rectangle &bounds);
+
+    // Bounds are assumed unchanged, only relinks when the cell changes
+    void move(Entity e, const Vector2 &position) {
+        Node &node = nodes[entity_index(e)];
+
+        assert(node.handle == e);
+
+        node.position = position;
+
+        int cell = get_cell(position);
+
+        if (cell != node.cell) {
+            unlink(entity_index(e));
+            link(entity_index(e), cell);
+        }
+    }
+
+    // Calls func(e) for the entities overlapping the rectangle until it returns true, returns whether it did
+    template<typename F>
+    bool query(const Rectangle &rectangle, F func) const {
+        if (width == 0)
+            return false;
+
+        int lower_x = get_cell_x(rectangle.x - extent);
+        int lower_y = get_cell_y(rectangle.y - extent);
+        int upper_x = get_cell_x(rectangle.x + rectangle.width + extent);
+        int upper_y = get_cell_y(rectangle.y + rectangle.height + extent);
+
+        for (int y = lower_y; y <= upper_y; y++)
+            for (int x = lower_x; x <= upper_x; x++) {
+                for (int slot = heads[x + y * width]; slot != -1; slot = nodes[slot].next) {
+                    const Node &node = nodes[slot];
+
+                    // Same test as check_collision
+                    float left = node.position.x + node.bounds.x;
+                    float top = node.position.y + node.bounds.y;
+
+                    if (rectangle.x < left + node.bounds.width && rectangle.x + rectangle.width > left &&
+                        rectangle.y < top + node.bounds.height && rectangle.y + rectangle.height > top && func(node.handle))
+                        return true;
+                }
+            }
+
+        return false;
+    }
+
+    bool overlaps(const Rectangle &rectangle) const {
+        return query(rectangle, [](Entity) { return true; });
+    }
+};
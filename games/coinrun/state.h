@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Snapshots are flat byte buffers in native layout. Writing with a null buffer only counts, so one pass can measure
+// the size and the next one write
+class State_Writer {
+public:
+    uint8_t* data = nullptr;
+    size_t size = 0;
+
+    void write(const void* src, size_t count) {
+        if (data != nullptr)
+            std::memcpy(data + size, src, count);
+
+        size += count;
+    }
+
+    template<typename T>
+    void write(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "State is copied as raw bytes");
+
+        write(&value, sizeof(T));
+    }
+};
+
+// Reads stop (and fail) at the end of the buffer instead of running past it, check failed once done
+class State_Reader {
+public:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+
+    bool failed = false;
+
+    void read(void* dst, size_t count) {
+        if (failed || count > size - offset) {
+            failed = true;
+
+            return;
+        }
+
+        std::memcpy(dst, data + offset, count);
+
+        offset += count;
+    }
+
+    template<typename T>
+    void read(T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "State is copied as raw bytes");
+
+        read(&value, sizeof(T));
+    }
+
+    // For counts read from the buffer before they size the next read
+    bool check(bool condition) {
+        failed = failed || !condition;
+
+        return !failed;
+    }
+};
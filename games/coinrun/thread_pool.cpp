@@ -0,0 +1,250 @@
+#include "thread_pool.h"
+
+#include <new>
+
+static inline uint64_t pack_range(uint32_t begin, uint32_t end) {
+    return (static_cast<uint64_t>(end) << 32) | begin;
+}
+
+static inline uint32_t range_begin(uint64_t range) {
+    return static_cast<uint32_t>(range);
+}
+
+static inline uint32_t range_end(uint64_t range) {
+    return static_cast<uint32_t>(range >> 32);
+}
+
+void Thread_Pool::init(int num_threads, bool stealing) {
+    if (num_threads <= 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    num_workers = num_threads;
+    this->stealing = stealing;
+
+    size_t space = (num_workers + 1) * sizeof(Worker_Queue);
+
+    queue_storage.reset(new char[space]);
+
+    void* storage = queue_storage.get();
+
+    std::align(cache_line_size, num_workers * sizeof(Worker_Queue), storage, space);
+
+    queues = static_cast<Worker_Queue*>(storage);
+
+    for (int i = 0; i < num_workers; i++)
+        new (&queues[i]) Worker_Queue();
+
+    // Worker 0 is the calling thread
+    for (int i = 1; i < num_workers; i++)
+        threads.emplace_back(&Thread_Pool::worker_loop, this, i);
+}
+
+void Thread_Pool::run(int num_tasks, const std::function<void(int)> &f) {
+    if (num_tasks <= 0)
+        return;
+
+    // No workers, just run in place
+    if (num_workers == 1) {
+        for (int i = 0; i < num_tasks; i++)
+            f(i);
+
+        return;
+    }
+
+    // Split evenly, stealing evens out the rest
+    for (int i = 0; i < num_workers; i++) {
+        uint32_t begin = static_cast<int64_t>(num_tasks) * i / num_workers;
+        uint32_t end = static_cast<int64_t>(num_tasks) * (i + 1) / num_workers;
+
+        queues[i].range.store(pack_range(begin, end), std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        task = &f;
+        num_active = num_workers - 1;
+        job_index++;
+    }
+
+    job_start.notify_all();
+
+    work(0);
+
+    // Workers only go idle once every task has been claimed and they have finished their own
+    std::unique_lock<std::mutex> lock(mutex);
+
+    job_done.wait(lock, [this] { return num_active == 0; });
+
+    task = nullptr;
+}
+
+void Thread_Pool::run_async(int num_tasks, const std::function<void(int)> &f) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Only one job in flight
+    async_done.wait(lock, [this] { return !async_pending && !async_running; });
+
+    if (!async_thread.joinable())
+        async_thread = std::thread(&Thread_Pool::async_loop, this);
+
+    async_task = &f;
+    async_num_tasks = num_tasks;
+    async_pending = true;
+
+    lock.unlock();
+
+    async_start.notify_one();
+}
+
+void Thread_Pool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    async_done.wait(lock, [this] { return !async_pending && !async_running; });
+}
+
+void Thread_Pool::async_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            async_start.wait(lock, [this] { return stopping || async_pending; });
+
+            if (stopping)
+                return;
+
+            async_pending = false;
+            async_running = true;
+        }
+
+        // Drives the job as worker 0
+        run(async_num_tasks, *async_task);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            async_running = false;
+            async_task = nullptr;
+        }
+
+        async_done.notify_all();
+    }
+}
+
+void Thread_Pool::worker_loop(int worker_index) {
+    uint64_t last_job_index = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            job_start.wait(lock, [&] { return stopping || job_index != last_job_index; });
+
+            if (stopping)
+                return;
+
+            last_job_index = job_index;
+        }
+
+        work(worker_index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            num_active--;
+
+            if (num_active == 0)
+                job_done.notify_one();
+        }
+    }
+}
+
+void Thread_Pool::work(int worker_index) {
+    const std::function<void(int)> &f = *task;
+
+    int task_index;
+
+    while (pop(worker_index, task_index) || (stealing && steal(worker_index, task_index)))
+        f(task_index);
+}
+
+bool Thread_Pool::pop(int worker_index, int &task_index) {
+    std::atomic<uint64_t> &range = queues[worker_index].range;
+
+    uint64_t r = range.load(std::memory_order_acquire);
+
+    while (range_begin(r) < range_end(r)) {
+        if (range.compare_exchange_weak(r, pack_range(range_begin(r) + 1, range_end(r)), std::memory_order_acq_rel)) {
+            task_index = range_begin(r);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Thread_Pool::steal(int worker_index, int &task_index) {
+    while (true) {
+        // Pick the victim with the most work left
+        int victim = -1;
+        uint32_t victim_size = 0;
+
+        for (int i = 1; i < num_workers; i++) {
+            int index = (worker_index + i) % num_workers;
+
+            uint64_t r = queues[index].range.load(std::memory_order_acquire);
+            uint32_t size = range_end(r) > range_begin(r) ? range_end(r) - range_begin(r) : 0;
+
+            if (size > victim_size) {
+                victim = index;
+                victim_size = size;
+            }
+        }
+
+        if (victim == -1)
+            return false;
+
+        std::atomic<uint64_t> &range = queues[victim].range;
+
+        uint64_t r = range.load(std::memory_order_acquire);
+
+        uint32_t begin = range_begin(r);
+        uint32_t end = range_end(r);
+
+        if (begin >= end)
+            continue;
+
+        // Take the back half
+        uint32_t mid = end - (end - begin + 1) / 2;
+
+        if (!range.compare_exchange_strong(r, pack_range(begin, mid), std::memory_order_acq_rel))
+            continue;
+
+        // Own queue is empty here, so no one else is touching it
+        queues[worker_index].range.store(pack_range(mid + 1, end), std::memory_order_release);
+
+        task_index = mid;
+
+        return true;
+    }
+}
+
+Thread_Pool::~Thread_Pool() {
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        stopping = true;
+    }
+
+    job_start.notify_all();
+    async_start.notify_one();
+
+    for (auto &thread : threads)
+        thread.join();
+
+    if (async_thread.joinable())
+        async_thread.join();
+}
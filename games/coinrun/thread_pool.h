@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <type_traits>
+
+// Runs index-parallel jobs on a fixed set of worker threads (the calling thread is one of them).
+// Each worker starts with a contiguous range of task indices, idle workers steal half of the largest remaining range
+class Thread_Pool {
+private:
+    static const int cache_line_size = 64;
+
+    // Task range packed as begin (low 32 bits) and end (high 32 bits) so it can be claimed with a single CAS.
+    // Padded to a cache line so workers don't contend on their neighbours' queues
+    struct Worker_Queue {
+        std::atomic<uint64_t> range{ 0 };
+
+        char padding[cache_line_size - sizeof(std::atomic<uint64_t>)];
+    };
+
+    static_assert(sizeof(Worker_Queue) == cache_line_size && std::is_trivially_destructible<Worker_Queue>::value, "Queues are placed in raw storage and never destroyed");
+
+    std::vector<std::thread> threads;
+
+    // C++14 new ignores over-alignment, so the queues are placed at a cache line boundary inside a larger buffer
+    std::unique_ptr<char[]> queue_storage;
+    Worker_Queue* queues = nullptr;
+
+    int num_workers = 1;
+    bool stealing = true;
+
+    std::mutex mutex;
+    std::condition_variable job_start;
+    std::condition_variable job_done;
+
+    const std::function<void(int)>* task = nullptr;
+    uint64_t job_index = 0;
+    int num_active = 0;
+    bool stopping = false;
+
+    // Background job (see run_async)
+    std::thread async_thread;
+    std::condition_variable async_start;
+    std::condition_variable async_done;
+
+    const std::function<void(int)>* async_task = nullptr;
+    int async_num_tasks = 0;
+    bool async_pending = false;
+    bool async_running = false;
+
+    void worker_loop(int worker_index);
+    void async_loop();
+    void work(int worker_index);
+
+    bool pop(int worker_index, int &task_index);
+    bool steal(int worker_index, int &task_index);
+
+public:
+    // Total number of threads including the caller, 0 uses all hardware threads.
+    // Without stealing each worker only runs its own slice (a static split, for comparison)
+    void init(int num_threads, bool stealing = true);
+
+    // Calls f(i) for i in [0, num_tasks), returns once all calls are done
+    void run(int num_tasks, const std::function<void(int)> &f);
+
+    // Same as run, but returns immediately. The job is driven by a background thread, call wait() before the next job.
+    // f is not copied, it has to stay alive until then
+    void run_async(int num_tasks, const std::function<void(int)> &f);
+    void wait();
+
+    bool is_running_async() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return async_pending || async_running;
+    }
+
+    int get_num_threads() const {
+        return num_workers;
+    }
+
+    ~Thread_Pool();
+};
@@ -1,5 +1,31 @@
 #include "tilemap.h"
 
+// Bitboard helpers
+inline uint64_t low_bits(int count) {
+    return count >= 64 ? ~uint64_t(0) : (count <= 0 ? 0 : (uint64_t(1) << count) - 1);
+}
+
+// Word whose bit i is bit x + i of row, bits outside the row are 0
+inline uint64_t shift_row(uint64_t row, int x) {
+    if (x >= 64 || x <= -64)
+        return 0;
+
+    return x >= 0 ? row >> x : row << -x;
+}
+
+inline int lowest_bit(uint64_t bits) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int index = 0;
+
+    for (; !(bits & 1); bits >>= 1)
+        index++;
+
+    return index;
+#endif
+}
+
 void System_Tilemap::init() {
     id_to_textures.resize(num_ids);
 
@@ -8,119 +34,248 @@ void System_Tilemap::init() {
     id_to_textures[wall_mid].resize(wall_themes.size());
 
     for (int i = 0; i < wall_themes.size(); i++) {
-        id_to_textures[wall_top][i].load("assets/kenney/Ground/" + wall_themes[i] + "/" + to_lower(wall_themes[i]) + "Mid.png");
-        id_to_textures[wall_mid][i].load("assets/kenney/Ground/" + wall_themes[i] + "/" + to_lower(wall_themes[i]) + "Center.png");
+        id_to_textures[wall_top][i] = &manager_texture.get("assets/kenney/Ground/" + wall_themes[i] + "/" + to_lower(wall_themes[i]) + "Mid.png");
+        id_to_textures[wall_mid][i] = &manager_texture.get("assets/kenney/Ground/" + wall_themes[i] + "/" + to_lower(wall_themes[i]) + "Center.png");
     }
 
     id_to_textures[lava_top].resize(1);
-    id_to_textures[lava_top][0].load("assets/kenney/Tiles/lavaTop_low.png");
+    id_to_textures[lava_top][0] = &manager_texture.get("assets/kenney/Tiles/lavaTop_low.png");
 
     id_to_textures[lava_mid].resize(1);
-    id_to_textures[lava_mid][0].load("assets/kenney/Tiles/lava.png");
+    id_to_textures[lava_mid][0] = &manager_texture.get("assets/kenney/Tiles/lava.png");
 
     id_to_textures[crate].resize(crate_types.size());
 
     for (int i = 0; i < crate_types.size(); i++)
-        id_to_textures[crate][i].load("assets/kenney/Tiles/" + crate_types[i] + ".png");
+        id_to_textures[crate][i] = &manager_texture.get("assets/kenney/Tiles/" + crate_types[i] + ".png");
 
     // Preload enemies
+    walking_enemy_frames.resize(walking_enemies.size());
+
     for (int i = 0; i < walking_enemies.size(); i++) {
-        manager_texture.get("assets/kenney/Enemies/" + walking_enemies[i] + ".png");
-        manager_texture.get("assets/kenney/Enemies/" + walking_enemies[i] + "_move.png");
+        walking_enemy_frames[i][0] = manager_texture.get_id("assets/kenney/Enemies/" + walking_enemies[i] + ".png");
+        walking_enemy_frames[i][1] = manager_texture.get_id("assets/kenney/Enemies/" + walking_enemies[i] + "_move.png");
     }
 
-    manager_texture.get("assets/kenney/Enemies/sawHalf.png");
-    manager_texture.get("assets/kenney/Enemies/sawHalf_move.png");
+    saw_frames[0] = manager_texture.get_id("assets/kenney/Enemies/sawHalf.png");
+    saw_frames[1] = manager_texture.get_id("assets/kenney/Enemies/sawHalf_move.png");
 
     // Pre-load coin
-    manager_texture.get("assets/kenney/Items/coinGold.png");
+    coin_texture = manager_texture.get_id("assets/kenney/Items/coinGold.png");
+
+    // Empty until the first install
+    tiles = std::make_shared<Tile_Grid>();
+    tiles->clear(0, 0);
 }
 
 // Tile manipulation
-void System_Tilemap::set_area(int x, int y, int width, int height, Tile_ID id) {
-    for (int dx = 0; dx < width; dx++)
-        for (int dy = 0; dy < height; dy++)
-            set(x + dx, y + dy, id);
+void Tile_Grid::clear(int width, int height) {
+    this->width = width;
+    this->height = height;
+
+    assert(width <= max_map_size && height <= max_map_size);
+
+    for (int id = 0; id < num_ids; id++)
+        id_rows[id].fill(0);
+
+    for (int i = 0; i < crate_type_bits; i++)
+        crate_type_rows[i].fill(0);
+
+    std::fill(id_rows[empty].begin(), id_rows[empty].begin() + height, low_bits(width));
 }
 
-void System_Tilemap::set_area_with_top(int x, int y, int width, int height, Tile_ID mid_id, Tile_ID top_id) {
+bool Tile_Grid::is_valid() const {
+    if (width < 0 || width > max_map_size || height < 0 || height > max_map_size)
+        return false;
+
+    for (int y = 0; y < max_map_size; y++) {
+        uint64_t tiles = 0;
+
+        for (int id = 0; id < num_ids; id++) {
+            if (id_rows[id][y] & tiles)
+                return false;
+
+            tiles |= id_rows[id][y];
+        }
+
+        if (tiles != (y < height ? low_bits(width) : 0))
+            return false;
+    }
+
+    return true;
+}
+
+void Tile_Grid::set_area(int x, int y, int width, int height, Tile_ID id) {
+    // Clip to the map, same as set
+    int x_start = std::max(0, x);
+    int x_end = std::min(this->width, x + width);
+    int y_start = std::max(0, y);
+    int y_end = std::min(this->height, y + height);
+
+    if (x_start >= x_end || y_start >= y_end)
+        return;
+
+    // Whole rows of the bitboards at once
+    uint64_t mask = low_bits(x_end) & ~low_bits(x_start);
+
+    for (int ty = y_start; ty < y_end; ty++) {
+        for (int i = 0; i < num_ids; i++)
+            id_rows[i][ty] &= ~mask;
+
+        id_rows[id][ty] |= mask;
+    }
+}
+
+void Tile_Grid::set_area_with_top(int x, int y, int width, int height, Tile_ID mid_id, Tile_ID top_id) {
     set_area(x, y, width, height - 1, mid_id);
     set_area(x, y + height - 1, width, 1, top_id);
 }
 
 // Spawning helpers
 void System_Tilemap::spawn_enemy_saw(int x, int y) {
-    Entity e = c.create_entity();
+    Entity e = world->create_entity();
 
-    Vector2 pos = { static_cast<float>(x) + 0.5f, static_cast<float>(map_height - 1 - y) + 0.5f };
+    Vector2 pos = { static_cast<float>(x) + 0.5f, static_cast<float>(tiles->height - 1 - y) + 0.5f };
 
     Component_Animation animation;
-    animation.frames.resize(2);
-    animation.frames[0] = &manager_texture.get("assets/kenney/Enemies/sawHalf.png");
-    animation.frames[1] = &manager_texture.get("assets/kenney/Enemies/sawHalf_move.png");
+    animation.frames[0] = saw_frames[0];
+    animation.frames[1] = saw_frames[1];
+    animation.num_frames = 2;
     animation.rate = 1.0f / 60.0f; // Every frame at 60 fps
 
-    c.add_component(e, Component_Transform{ .position{ pos } });
-    c.add_component(e, Component_Sprite{ .position{ -0.5f, -0.5f }, .z = 1.0f });
-    c.add_component(e, Component_Hazard{});
-    c.add_component(e, Component_Collision{ .bounds{ -0.5f, -0.5f, 1.0f, 1.0f }});
-    c.add_component(e, animation);
+    world->add_components(e,
+        Component_Transform{ .position{ pos } },
+        Component_Sprite{ .position{ -0.5f, -0.5f }, .z = 1.0f },
+        Component_Hazard{},
+        Component_Collision{ .bounds{ -0.5f, -0.5f, 1.0f, 1.0f }},
+        animation);
 }
 
-void System_Tilemap::spawn_enemy_mob(int x, int y, std::mt19937 &rng) {
-    std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+void System_Tilemap::spawn_enemy_mob(int x, int y, int enemy_index, float velocity_x) {
+    Entity e = world->create_entity();
 
-    Entity e = c.create_entity();
+    Vector2 pos = { static_cast<float>(x) + 0.5f, static_cast<float>(tiles->height - 1 - y) + 0.5f };
 
-    Vector2 pos = { static_cast<float>(x) + 0.5f, static_cast<float>(map_height - 1 - y) + 0.5f };
+    Component_Animation animation;
+    animation.frames[0] = walking_enemy_frames[enemy_index][0];
+    animation.frames[1] = walking_enemy_frames[enemy_index][1];
+    animation.num_frames = 2;
+    animation.rate = 0.5f;
 
-    std::uniform_int_distribution<int> walking_enemy_dist(0, walking_enemies.size() - 1);
+    world->add_components(e,
+        Component_Transform{ .position{ pos } },
+        Component_Sprite{ .position{ -0.5f, -0.5f }, .z = 1.0f },
+        Component_Hazard{},
+        Component_Collision{ .bounds{ -0.5f, -0.48f, 1.0f, 0.98f }},
+        Component_Mob_AI{ .velocity_x = velocity_x },
+        Component_Particles{ .offset{ 0.0f, 0.34f } },
+        animation);
+}
 
-    int enemy_index = walking_enemy_dist(rng);
+void System_Tilemap::spawn_coin(int x, int y) {
+    Entity e = world->create_entity();
 
-    Component_Animation animation;
-    animation.frames.resize(2);
-    animation.frames[0] = &manager_texture.get("assets/kenney/Enemies/" + walking_enemies[enemy_index] + ".png");
-    animation.frames[1] = &manager_texture.get("assets/kenney/Enemies/" + walking_enemies[enemy_index] + "_move.png");
-    animation.rate = 0.5f;
+    Vector2 pos = { static_cast<float>(x) + 0.5f, static_cast<float>(tiles->height - 1 - y) + 0.5f };
+
+    world->add_components(e,
+        Component_Transform{ .position{ pos } },
+        Component_Sprite{ .position{ -0.5f, -0.5f }, .z = 1.0f, .texture = coin_texture },
+        Component_Goal{},
+        Component_Collision{ .bounds{ -0.5f, -0.5f, 1.0f, 1.0f }});
+}
+
+void System_Tilemap::install(const Layout &layout) {
+    set_tiles(layout.tiles);
+
+    no_collide_rows.fill(0);
+
+    for (int i = 0; i < layout.num_spawns; i++) {
+        const Level_Spawn &spawn = layout.spawns[i];
+
+        switch (spawn.type) {
+        case Level_Spawn::saw:
+            spawn_enemy_saw(spawn.x, spawn.y);
+
+            break;
+        case Level_Spawn::mob:
+            spawn_enemy_mob(spawn.x, spawn.y, spawn.enemy_index, spawn.velocity_x);
+
+            break;
+        case Level_Spawn::coin:
+            spawn_coin(spawn.x, spawn.y);
+
+            break;
+        }
+    }
+}
+
+bool System_Tilemap::Layout::is_valid() const {
+    // The agent spawns in tile (1, height - 2)
+    if (!tiles.is_valid() || tiles.width < 2 || tiles.height < 2 || num_spawns < 0 || num_spawns > max_level_spawns)
+        return false;
+
+    for (int i = 0; i < num_spawns; i++) {
+        const Level_Spawn &spawn = spawns[i];
+
+        if (spawn.type > Level_Spawn::coin || spawn.x >= tiles.width || spawn.y >= tiles.height)
+            return false;
+
+        if (spawn.type == Level_Spawn::mob && (spawn.enemy_index >= walking_enemies.size() || !std::isfinite(spawn.velocity_x)))
+            return false;
+    }
+
+    return true;
+}
+
+bool System_Tilemap::set_tiles(const Tile_Grid &grid) {
+    if (std::memcmp(&grid, tiles.get(), sizeof(Tile_Grid)) == 0)
+        return false;
 
-    c.add_component(e, Component_Transform{ .position{ pos } });
-    c.add_component(e, Component_Sprite{ .position{ -0.5f, -0.5f }, .z = 1.0f });
-    c.add_component(e, Component_Hazard{});
-    c.add_component(e, Component_Collision{ .bounds{ -0.5f, -0.48f, 1.0f, 0.98f }});
-    c.add_component(e, Component_Mob_AI{ .velocity_x = 1.5f * ((dist01(rng) < 0.5f) * 2.0f - 1.0f) });
-    c.add_component(e, Component_Particles{ .particles = std::vector<Particle>(10), .offset{ 0.0f, 0.34f } });
-    c.add_component(e, animation);
+    // Blocks are immutable once shared, only the sole owner may write in place
+    if (tiles.use_count() == 1)
+        *tiles = grid;
+    else
+        tiles = std::make_shared<Tile_Grid>(grid);
+
+    return true;
+}
+
+bool System_Tilemap::share_tiles(const std::shared_ptr<Tile_Grid> &block) {
+    if (block == tiles)
+        return false;
+
+    tiles = block;
+
+    return true;
 }
 
 // Main map generation
-void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
+void System_Tilemap::generate(Layout &layout, std::mt19937 &rng, const Config &cfg) {
     const int main_width = 64;
     const int main_height = 64;
     const float max_jump = 1.5f;
     const float gravity = 0.2f;
     const float max_speed = 0.5f;
 
-    this->map_width = main_width;
-    this->map_height = main_height;
-
-    tile_ids.resize(map_width * map_height);
-    crate_type_indices.resize(tile_ids.size());
-    no_collide_mask.resize(tile_ids.size());
+    Tile_Grid &tiles = layout.tiles;
 
     // Clear
-    std::fill(tile_ids.begin(), tile_ids.end(), empty);
-    std::fill(no_collide_mask.begin(), no_collide_mask.end(), false);
+    tiles.clear(main_width, main_height);
+
+    layout.num_spawns = 0;
 
     // Initialize floors and walls
-    set_area(0, 0, main_width, 1, wall_top);
-    set_area(0, 0, 1, main_height, wall_mid);
-    set_area(main_width - 1, 0, 1, main_height, wall_mid);
-    set_area(0, main_height - 1, main_width, 1, wall_mid);
+    tiles.set_area(0, 0, main_width, 1, wall_top);
+    tiles.set_area(0, 0, 1, main_height, wall_mid);
+    tiles.set_area(main_width - 1, 0, 1, main_height, wall_mid);
+    tiles.set_area(0, main_height - 1, main_width, 1, wall_mid);
 
     std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
     std::uniform_int_distribution<int> crate_dist(0, crate_types.size() - 1);
 
+    assert(crate_types.size() <= (1 << crate_type_bits));
+    std::uniform_int_distribution<int> walking_enemy_dist(0, walking_enemies.size() - 1);
+
     std::uniform_int_distribution<int> difficulty_dist(1, 3);
 
     int difficulty = difficulty_dist(rng);
@@ -149,6 +304,14 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
 
     bool allow_monsters = !cfg.easy_mode;
 
+    // Enemy and direction are drawn as the mob is placed
+    auto push_mob = [&](int x, int y) {
+        int enemy_index = walking_enemy_dist(rng);
+        float velocity_x = 1.5f * ((dist01(rng) < 0.5f) * 2.0f - 1.0f);
+
+        layout.add_spawn(Level_Spawn::mob, x, y, enemy_index, velocity_x);
+    };
+
     for (int section = 0; section < num_sections; section++) {
         if (curr_x + 15 >= w)
             break;
@@ -187,8 +350,8 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
                 x2 = dx - x1 - pit_width;
             }
 
-            set_area_with_top(curr_x, 0, x1, curr_y, wall_mid, wall_top);
-            set_area_with_top(curr_x + dx - x2, 0, x2, curr_y, wall_mid, wall_top);
+            tiles.set_area_with_top(curr_x, 0, x1, curr_y, wall_mid, wall_top);
+            tiles.set_area_with_top(curr_x + dx - x2, 0, x2, curr_y, wall_mid, wall_top);
 
             std::uniform_int_distribution<int> lava_height_dist(1, curr_y - 3);
 
@@ -196,17 +359,17 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
 
             switch (danger_type) {
             case 0:
-                set_area_with_top(curr_x + x1, 1, pit_width, lava_height, lava_mid, lava_top);
+                tiles.set_area_with_top(curr_x + x1, 1, pit_width, lava_height, lava_mid, lava_top);
 
                 break;
             case 1:
                 for (int i = 0; i < pit_width; i++)
-                    spawn_enemy_saw(curr_x + x1 + i, 1);
+                    layout.add_spawn(Level_Spawn::saw, curr_x + x1 + i, 1);
 
                 break;
             case 2:
                 for (int i = 0; i < pit_width; i++)
-                    spawn_enemy_mob(curr_x + x1 + i, 1, rng);
+                    push_mob(curr_x + x1 + i, 1);
 
                 break;
             }
@@ -230,11 +393,11 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
                     w1 = pit_width - x3 - x4;
                 }
 
-                set_area_with_top(curr_x + x1 + x3, curr_y - 1, w1, 1, wall_mid, wall_top);
+                tiles.set_area_with_top(curr_x + x1 + x3, curr_y - 1, w1, 1, wall_mid, wall_top);
             }
         }
         else {
-            set_area_with_top(curr_x, 0, dx, curr_y, wall_mid, wall_top);
+            tiles.set_area_with_top(curr_x, 0, dx, curr_y, wall_mid, wall_top);
 
             int ob1_x = -1;
             int ob2_x = -1;
@@ -246,7 +409,7 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
 
                 ob1_x = curr_x + x_dist(rng);
 
-                spawn_enemy_saw(ob1_x, curr_y);
+                layout.add_spawn(Level_Spawn::saw, ob1_x, curr_y);
             }
 
             if (cfg.allow_mobs && spawn_dist(rng) < difficulty && dx > 3 && max_dx >= 4) {
@@ -254,7 +417,7 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
 
                 ob1_x = curr_x + x_dist(rng);
 
-                spawn_enemy_mob(ob1_x, curr_y, rng);
+                push_mob(ob1_x, curr_y);
             }
 
              if (cfg.allow_crate) {
@@ -267,8 +430,8 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
                         int pile_height = dist3(rng);
 
                         for (int j = 0; j < pile_height; j++) {
-                            set(crate_x, curr_y + j, crate);
-                            crate_type_indices[curr_y + j + crate_x * map_height] = crate_dist(rng);
+                            tiles.set(crate_x, curr_y + j, crate);
+                            tiles.set_crate_type(crate_x, curr_y + j, crate_dist(rng));
                         }
                     }
                 }
@@ -279,23 +442,16 @@ void System_Tilemap::regenerate(std::mt19937 &rng, const Config &cfg) {
     }
 
     // Spawn the coin
-    Entity coin = c.create_entity();
+    layout.add_spawn(Level_Spawn::coin, curr_x, curr_y);
 
-    Vector2 pos = { static_cast<float>(curr_x) + 0.5f, static_cast<float>(map_height - 1 - curr_y) + 0.5f };
+    tiles.set_area_with_top(curr_x, 0, 1, curr_y, wall_mid, wall_top);
 
-    c.add_component(coin, Component_Transform{ .position{ pos } });
-    c.add_component(coin, Component_Sprite{ .position{ -0.5f, -0.5f }, .z = 1.0f, .texture = &manager_texture.get("assets/kenney/Items/coinGold.png") });
-    c.add_component(coin, Component_Goal{});
-    c.add_component(coin, Component_Collision{ .bounds{ -0.5f, -0.5f, 1.0f, 1.0f }});
-
-    set_area_with_top(curr_x, 0, 1, curr_y, wall_mid, wall_top);
-
-    set_area(curr_x + 1, 0, main_width - curr_x, main_height, wall_mid);
+    tiles.set_area(curr_x + 1, 0, main_width - curr_x, main_height, wall_mid);
 }
 
 void System_Tilemap::render(int theme) {
-    Rectangle camera_aabb{ (gr.camera_position.x - gr.camera_size.x * 0.5f / gr.camera_scale) * pixels_to_unit, (gr.camera_position.y - gr.camera_size.y * 0.5f / gr.camera_scale) * pixels_to_unit,
-        gr.camera_size.x * pixels_to_unit / gr.camera_scale, gr.camera_size.y * pixels_to_unit / gr.camera_scale };
+    Rectangle camera_aabb{ (gr->camera_position.x - gr->camera_size.x * 0.5f / gr->camera_scale) * pixels_to_unit, (gr->camera_position.y - gr->camera_size.y * 0.5f / gr->camera_scale) * pixels_to_unit,
+        gr->camera_size.x * pixels_to_unit / gr->camera_scale, gr->camera_size.y * pixels_to_unit / gr->camera_scale };
 
     int lower_x = std::floor(camera_aabb.x);
     int lower_y = std::floor(camera_aabb.y);
@@ -304,7 +460,7 @@ void System_Tilemap::render(int theme) {
     
     for (int y = lower_y; y <= upper_y; y++)
         for (int x = lower_x; x <= upper_x; x++) {
-            Tile_ID id = get(x, map_height - 1 - y);
+            Tile_ID id = get(x, tiles->height - 1 - y);
 
             if (id == 0) // Empty
                 continue;
@@ -312,17 +468,64 @@ void System_Tilemap::render(int theme) {
             Asset_Texture* tex;
 
             if (id == wall_mid || id == wall_top)
-                tex = &id_to_textures[id][theme];
+                tex = id_to_textures[id][theme];
             else if (id == lava_mid || id == lava_top)
-                tex = &id_to_textures[id][0];
+                tex = id_to_textures[id][0];
             else if (id == crate)
-                tex = &id_to_textures[id][crate_type_indices[map_height - 1 - y + x * map_height]];
+                tex = id_to_textures[id][tiles->get_crate_type(x, tiles->height - 1 - y)];
 
-            gr.render_texture(tex, (Vector2){ x * unit_to_pixels, y * unit_to_pixels }, unit_to_pixels / tex->width);
+            gr->render_texture(tex, (Vector2){ x * unit_to_pixels, y * unit_to_pixels }, unit_to_pixels / tex->width);
         }
 }
 
-std::pair<Vector2, bool> System_Tilemap::get_collision(Rectangle rectangle, const std::function<Collision_Type(Tile_ID)> &collision_id_func, float velocity_y) {
+uint64_t System_Tilemap::get_row_bits(int x, int y, int count, uint32_t ids) const {
+    bool wall = (ids >> wall_mid) & 1;
+
+    uint64_t bits;
+
+    if (y < 0 || y >= tiles->height)
+        bits = wall ? ~uint64_t(0) : 0;
+    else {
+        uint64_t row = 0;
+
+        for (; ids != 0; ids &= ids - 1)
+            row |= tiles->id_rows[lowest_bit(ids)][y];
+
+        bits = shift_row(row, x);
+
+        // Columns left and right of the map
+        if (wall)
+            bits |= low_bits(-x) | ~low_bits(tiles->width - x);
+    }
+
+    return bits & low_bits(count);
+}
+
+template<typename F>
+void System_Tilemap::for_each_colliding_tile(int lower_x, int lower_y, int upper_x, int upper_y, uint32_t full_ids, uint32_t down_only_ids, F f) const {
+    for (int y = lower_y; y <= upper_y; y++) {
+        int tile_y = tiles->height - 1 - y;
+
+        // A word of columns at a time, bits are relative to x
+        for (int x = lower_x; x <= upper_x; x += 64) {
+            int count = std::min(64, upper_x - x + 1);
+
+            uint64_t no_collide = tile_y >= 0 && tile_y < tiles->height ? shift_row(no_collide_rows[tile_y], x) : 0;
+
+            uint64_t full_bits = get_row_bits(x, tile_y, count, full_ids) & ~no_collide;
+            uint64_t down_only_bits = down_only_ids != 0 ? get_row_bits(x, tile_y, count, down_only_ids) & ~no_collide : 0;
+
+            // Set bits are visited from low to high, the same left to right order as a tile by tile scan
+            for (uint64_t bits = full_bits | down_only_bits; bits != 0; bits &= bits - 1) {
+                int i = lowest_bit(bits);
+
+                f(x + i, y, (down_only_bits >> i) & 1 ? down_only : full);
+            }
+        }
+    }
+}
+
+std::pair<Vector2, bool> System_Tilemap::get_collision(Rectangle rectangle, const Collision_Table &collision_table, float velocity_y) {
     bool collided = false;
 
     int lower_x = std::floor(rectangle.x);
@@ -335,60 +538,55 @@ std::pair<Vector2, bool> System_Tilemap::get_collision(Rectangle rectangle, cons
     Rectangle tile;
     tile.width = 1.0f;
     tile.height = 1.0f;
-    
-    // Need two passes to avoid "snagging" on tiles when sliding along a wall
 
-    // Pass 1 (horizontal)
-    for (int y = lower_y; y <= upper_y; y++)
-        for (int x = lower_x; x <= upper_x; x++) {
-            Tile_ID id = get(x, map_height - 1 - y);
+    uint32_t full_ids = 0;
+    uint32_t down_only_ids = 0;
 
-            Collision_Type type = collision_id_func(id);
+    for (int id = 0; id < num_ids; id++) {
+        full_ids |= (collision_table[id] == full) << id;
+        down_only_ids |= (collision_table[id] == down_only) << id;
+    }
 
-            if (type != none && !no_collide_mask[(map_height - 1 - y) + x * map_height]) {
-                tile.x = x;
-                tile.y = y;
+    // Need two passes to avoid "snagging" on tiles when sliding along a wall. Both visit the tiles overlapping the
+    // rectangle as it was on entry
 
-                Rectangle collision = get_collision_overlap(rectangle, tile);
+    // Pass 1 (horizontal)
+    for_each_colliding_tile(lower_x, lower_y, upper_x, upper_y, full_ids, down_only_ids, [&](int x, int y, Collision_Type type) {
+        tile.x = x;
+        tile.y = y;
 
-                if (collision.width != 0.0f || collision.height != 0.0f) {
-                    collided = true;
+        Rectangle collision = get_collision_overlap(rectangle, tile);
 
-                    Vector2 collision_center{ collision.x + collision.width * 0.5f, collision.y + collision.height * 0.5f };
+        if (collision.width != 0.0f || collision.height != 0.0f) {
+            collided = true;
 
-                    if (collision.width <= collision.height) {
-                        if (type != down_only)
-                            rectangle.x = (collision_center.x > center.x ? tile.x - rectangle.width : tile.x + tile.width);
-                    }
-                }
+            Vector2 collision_center{ collision.x + collision.width * 0.5f, collision.y + collision.height * 0.5f };
+
+            if (collision.width <= collision.height) {
+                if (type != down_only)
+                    rectangle.x = (collision_center.x > center.x ? tile.x - rectangle.width : tile.x + tile.width);
             }
         }
+    });
 
     // Pass 2 (vertical)
-    for (int y = lower_y; y <= upper_y; y++)
-        for (int x = lower_x; x <= upper_x; x++) {
-            Tile_ID id = get(x, map_height - 1 - y);
+    for_each_colliding_tile(lower_x, lower_y, upper_x, upper_y, full_ids, down_only_ids, [&](int x, int y, Collision_Type type) {
+        tile.x = x;
+        tile.y = y;
 
-            Collision_Type type = collision_id_func(id);
+        Rectangle collision = get_collision_overlap(rectangle, tile);
 
-            if (type != none && !no_collide_mask[(map_height - 1 - y) + x * map_height]) {
-                tile.x = x;
-                tile.y = y;
+        if (collision.width != 0.0f || collision.height != 0.0f) {
+            Vector2 collision_center{ collision.x + collision.width * 0.5f, collision.y + collision.height * 0.5f };
 
-                Rectangle collision = get_collision_overlap(rectangle, tile);
-
-                if (collision.width != 0.0f || collision.height != 0.0f) {
-                    Vector2 collision_center{ collision.x + collision.width * 0.5f, collision.y + collision.height * 0.5f };
-
-                    if (collision.width > collision.height) {
-                        if (type == down_only)
-                            rectangle.y = (velocity_y > 0.0f ? (collision_center.y > center.y ? tile.y - rectangle.height : tile.y + tile.height) : rectangle.y);
-                        else
-                            rectangle.y = (collision_center.y > center.y ? tile.y - rectangle.height : tile.y + tile.height);
-                    }
-                }
+            if (collision.width > collision.height) {
+                if (type == down_only)
+                    rectangle.y = (velocity_y > 0.0f ? (collision_center.y > center.y ? tile.y - rectangle.height : tile.y + tile.height) : rectangle.y);
+                else
+                    rectangle.y = (collision_center.y > center.y ? tile.y - rectangle.height : tile.y + tile.height);
             }
         }
+    });
 
     return std::make_pair(Vector2{ rectangle.x, rectangle.y }, collided);
 }
@@ -400,27 +598,32 @@ void System_Tilemap::update_no_collide(const Rectangle &player_rectangle, const
     // Only check "real" tiles (not out of bounds) by clamping to 0, width/height range
     int lower_x = std::max(0, static_cast<int>(std::floor(outer_rectangle.x)));
     int lower_y = std::max(0, static_cast<int>(std::floor(outer_rectangle.y)));
-    int upper_x = std::min(map_width - 1, static_cast<int>(std::ceil(outer_rectangle.x + outer_rectangle.width)));
-    int upper_y = std::min(map_height - 1, static_cast<int>(std::ceil(outer_rectangle.y + outer_rectangle.height)));
+    int upper_x = std::min(tiles->width - 1, static_cast<int>(std::ceil(outer_rectangle.x + outer_rectangle.width)));
+    int upper_y = std::min(tiles->height - 1, static_cast<int>(std::ceil(outer_rectangle.y + outer_rectangle.height)));
+
+    if (lower_x > upper_x)
+        return;
+
+    uint64_t window = low_bits(upper_x + 1) & ~low_bits(lower_x);
 
     Rectangle tile;
     tile.width = 1.0f;
     tile.height = 1.0f;
     
-    for (int y = lower_y; y <= upper_y; y++)
-        for (int x = lower_x; x <= upper_x; x++) {
-            Tile_ID id = get(x, map_height - 1 - y);
+    for (int y = lower_y; y <= upper_y; y++) {
+        int tile_y = tiles->height - 1 - y;
 
-            int index = (map_height - 1 - y) + x * map_height;
+        // Only crates can be fallen through
+        for (uint64_t bits = tiles->id_rows[crate][tile_y] & window; bits != 0; bits &= bits - 1) {
+            int x = lowest_bit(bits);
 
-            if (id == crate) {
-                tile.x = x;
-                tile.y = y;
+            tile.x = x;
+            tile.y = y;
 
-                if (!check_collision(player_rectangle, tile))
-                    no_collide_mask[index] = false;
-                else if (check_collision(shifted_rectangle, tile))
-                    no_collide_mask[index] = true;
-            }
+            if (!check_collision(player_rectangle, tile))
+                no_collide_rows[tile_y] &= ~(uint64_t(1) << x);
+            else if (check_collision(shifted_rectangle, tile))
+                no_collide_rows[tile_y] |= uint64_t(1) << x;
         }
+    }
 }
@@ -8,9 +8,12 @@
 #include <cmath>
 #include <algorithm>
 #include <random>
-#include <functional>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 
-enum Tile_ID {
+enum Tile_ID : uint8_t {
     empty = 0,
     wall_top,
     wall_mid,
@@ -26,10 +29,109 @@ enum Collision_Type {
     down_only
 };
 
+// Collision type of each Tile_ID, decides which tiles get_collision resolves against
+typedef std::array<Collision_Type, num_ids> Collision_Table;
+
+// In Tile_ID order: empty, wall_top, wall_mid, lava_top, lava_mid, crate
+static const Collision_Table wall_collision_table{ none, full, full, none, none, none };
+static const Collision_Table agent_collision_table{ none, full, full, none, none, down_only }; // Crates are platforms
+static const Collision_Table lava_collision_table{ none, none, none, full, full, none };
+static const Collision_Table empty_collision_table{ full, none, none, none, none, none }; // For finding gaps
+
 static const std::vector<std::string> wall_themes = { "Dirt", "Grass", "Planet", "Sand", "Snow", "Stone" };
 static const std::vector<std::string> walking_enemies = { "slimeBlock", "slimePurple", "slimeBlue", "slimeGreen", "mouse", "snail", "ladybug", "wormGreen", "wormPink" };
 static const std::vector<std::string> crate_types = { "boxCrate", "boxCrate_double", "boxCrate_single", "boxCrate_warning" };
 
+// Bitboard rows are one word, so maps are at most this many tiles wide. Also caps the height to keep grids fixed size
+const int max_map_size = 64;
+
+// Most entities a level places, the generator asserts it stays below
+const int max_level_spawns = 64;
+
+// Crate textures are indexed with this many bits
+const int crate_type_bits = 2;
+
+// Tiles of a level, kept apart from the system so levels can be generated off the main thread.
+// Only bitboards: fixed size, trivially copyable and small, so a level is copied (or cached) with a memcpy
+struct Tile_Grid {
+    int width;
+    int height;
+
+    // Row-major bitboards, bit x of word y is tile (x, y). Each tile's bit is set in exactly one board
+    std::array<std::array<uint64_t, max_map_size>, num_ids> id_rows;
+
+    // Bit planes of the crate texture index, same layout
+    std::array<std::array<uint64_t, max_map_size>, crate_type_bits> crate_type_rows;
+
+    // Resize and fill with empty
+    void clear(int width, int height);
+
+    // Whether the size is in range and every tile is set in exactly one board (get relies on it), for untrusted grids
+    bool is_valid() const;
+
+    // Set a tile
+    void set(int x, int y, Tile_ID id) {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return;
+
+        for (int i = 0; i < num_ids; i++)
+            id_rows[i][y] &= ~(uint64_t(1) << x);
+
+        id_rows[id][y] |= uint64_t(1) << x;
+    }
+
+    // Top left corner x y, size, id to fill
+    void set_area(int x, int y, int width, int height, Tile_ID id);
+    void set_area_with_top(int x, int y, int width, int height, Tile_ID mid_id, Tile_ID top_id);
+
+    // Get a tile
+    Tile_ID get(int x, int y) const {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return wall_mid; // Out of bounds is a wall
+
+        int id = 0;
+
+        while (!((id_rows[id][y] >> x) & 1))
+            id++;
+
+        return static_cast<Tile_ID>(id);
+    }
+
+    void set_crate_type(int x, int y, int type) {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return;
+
+        for (int i = 0; i < crate_type_bits; i++)
+            crate_type_rows[i][y] = (crate_type_rows[i][y] & ~(uint64_t(1) << x)) | (uint64_t((type >> i) & 1) << x);
+    }
+
+    int get_crate_type(int x, int y) const {
+        int type = 0;
+
+        for (int i = 0; i < crate_type_bits; i++)
+            type |= ((crate_type_rows[i][y] >> x) & 1) << i;
+
+        return type;
+    }
+};
+
+// Entity placed by the generator, spawned by System_Tilemap::install
+struct Level_Spawn {
+    enum Type : uint8_t {
+        saw = 0,
+        mob,
+        coin
+    };
+
+    Type type;
+
+    uint8_t x, y; // Tile
+
+    // Mobs only
+    uint8_t enemy_index;
+    float velocity_x;
+};
+
 // Tile map system
 class System_Tilemap : public System {
 public:
@@ -43,68 +145,117 @@ public:
         bool allow_crate = true;
         bool allow_dy = true;
         bool allow_mobs = true;
+
+        bool operator==(const Config &other) const {
+            return easy_mode == other.easy_mode && allow_pit == other.allow_pit && allow_crate == other.allow_crate &&
+                allow_dy == other.allow_dy && allow_mobs == other.allow_mobs;
+        }
+    };
+
+    // Everything generate decides, spawns are in creation order
+    struct Layout {
+        Tile_Grid tiles;
+
+        std::array<Level_Spawn, max_level_spawns> spawns;
+        int num_spawns;
+
+        void add_spawn(Level_Spawn::Type type, int x, int y, int enemy_index = 0, float velocity_x = 0.0f) {
+            assert(num_spawns < max_level_spawns);
+
+            Level_Spawn &spawn = spawns[num_spawns++];
+
+            spawn.type = type;
+            spawn.x = x;
+            spawn.y = y;
+            spawn.enemy_index = enemy_index;
+            spawn.velocity_x = velocity_x;
+        }
+
+        // Whether the grid and spawns are in range, for layouts read from outside the generator (level packs)
+        bool is_valid() const;
     };
 
 private:
-    int map_width, map_height;
+    std::vector<std::vector<Asset_Texture*>> id_to_textures;
 
-    std::vector<std::vector<Asset_Texture>> id_to_textures;
+    // Looked up once so spawning does not build asset paths
+    std::vector<std::array<Texture_ID, 2>> walking_enemy_frames;
+    std::array<Texture_ID, 2> saw_frames;
+    Texture_ID coin_texture;
 
-    std::vector<Tile_ID> tile_ids;
-    std::vector<int> crate_type_indices;
-    std::vector<bool> no_collide_mask; // For fallthrough tiles like crates
+    // Immutable while shared: snapshots of the level (cenv_state) hold the same block instead of a copy
+    std::shared_ptr<Tile_Grid> tiles;
+
+    std::array<uint64_t, max_map_size> no_collide_rows; // For fallthrough tiles like crates, same layout as the tile bitboards
+
+    // Bit i is set when tile (x + i, y) is one of ids (a bit per Tile_ID), i < count. Out of bounds is a wall
+    uint64_t get_row_bits(int x, int y, int count, uint32_t ids) const;
+
+    // Calls f(x, y, type) for every tile in [lower_x, upper_x] x [lower_y, upper_y] (world rows, y up) with one of full_ids
+    // or down_only_ids, fallthrough tiles excluded. Row by row, left to right within a row, for any size of range
+    template<typename F>
+    void for_each_colliding_tile(int lower_x, int lower_y, int upper_x, int upper_y, uint32_t full_ids, uint32_t down_only_ids, F f) const;
 
     void spawn_enemy_saw(int x, int y);
-    void spawn_enemy_mob(int x, int y, std::mt19937 &rng);
+    void spawn_enemy_mob(int x, int y, int enemy_index, float velocity_x);
+    void spawn_coin(int x, int y);
 
 public:
     // Initialize the tilemap
     void init();
 
-    // Generate a new random map
-    void regenerate(std::mt19937 &rng, const Config &cfg);
-
-    // Set a tile
-    void set(int x, int y, Tile_ID id) {
-        if (x < 0 || y < 0 || x >= map_width || y >= map_height)
-            return;
+    // Generate a new random map into layout. Touches nothing but its arguments, so it can run on any thread and
+    // the same RNG state and config always give the same layout
+    static void generate(Layout &layout, std::mt19937 &rng, const Config &cfg);
 
-        tile_ids[y + x * map_height] = id;
-    }
-
-    // Top left corner x y, size, id to fill
-    void set_area(int x, int y, int width, int height, Tile_ID id);
-    void set_area_with_top(int x, int y, int width, int height, Tile_ID mid_id, Tile_ID top_id);
+    // Replace the map with the layout's tiles and spawn its entities
+    void install(const Layout &layout);
 
     // Get a tile
-    Tile_ID get(int x, int y) {
-        if (x < 0 || y < 0 || x >= map_width || y >= map_height)
-            return wall_mid; // Out of bounds is a wall
-
-        return tile_ids[y + x * map_height];
+    Tile_ID get(int x, int y) const {
+        return tiles->get(x, y);
     }
 
     void render(int theme);
 
     // General collision detection, returns new rectangle position and a collision flag
-    std::pair<Vector2, bool> get_collision(Rectangle rectangle, const std::function<Collision_Type(Tile_ID)> &collision_id_func, float velocity_y = 0.0f);
+    std::pair<Vector2, bool> get_collision(Rectangle rectangle, const Collision_Table &collision_table, float velocity_y = 0.0f);
 
     // For fall-through platforms
     void update_no_collide(const Rectangle &player_rectangle, const Rectangle &outer_rectangle);
 
     void set_no_collide(int x, int y) {
-        if (x < 0 || y < 0 || x >= map_width || y >= map_height)
+        if (x < 0 || y < 0 || x >= tiles->width || y >= tiles->height)
             return;
 
         if (get(x, y) == crate)
-            no_collide_mask[y + x * map_height] = true;
+            no_collide_rows[y] |= uint64_t(1) << x;
+    }
+
+    // Replace the tiles, in place unless the block is shared. Returns whether they changed
+    bool set_tiles(const Tile_Grid &grid);
+
+    // Use a block of tiles that is already shared. Returns whether it is another block
+    bool share_tiles(const std::shared_ptr<Tile_Grid> &block);
+
+    const std::shared_ptr<Tile_Grid> &get_tiles() const {
+        return tiles;
+    }
+
+    // Fall-through state, the tiles are level data and the entities are saved with the world
+    void save_state(State_Writer &writer) const {
+        writer.write(no_collide_rows);
+    }
+
+    void load_state(State_Reader &reader) {
+        reader.read(no_collide_rows);
     }
 
     int get_width() const {
-        return map_width;
+        return tiles->width;
     }
 
     int get_height() const {
-        return map_height;
+        return tiles->height;
     }
 };
@@ -0,0 +1,110 @@
+#include "../../cenv/cenv.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+
+// Batch step throughput against the thread count: work stealing, a static split of the instances, and work stealing
+// driven through step_async/step_wait. Prints a markdown table. Run from the repository root (assets are loaded from
+// there) on a machine with the cores to measure:
+//     bench_batch [num_instances] [num_steps] [max_threads]
+
+// Fixed action sequence, so every mode sees the same levels
+static unsigned int action_state = 1;
+
+static int next_action() {
+    action_state = action_state * 1103515245u + 12345u;
+
+    return (action_state >> 8) % 15;
+}
+
+// Steps per second, 0 if the batch could not be made
+static double measure(int num_instances, int num_steps, int num_threads, bool work_stealing, bool async) {
+    cenv_option options[3];
+
+    options[0].name = "seed";
+    options[0].value_type = CENV_VALUE_TYPE_INT;
+    options[0].value.i = 42;
+
+    options[1].name = "num_threads";
+    options[1].value_type = CENV_VALUE_TYPE_INT;
+    options[1].value.i = num_threads;
+
+    options[2].name = "work_stealing";
+    options[2].value_type = CENV_VALUE_TYPE_INT;
+    options[2].value.i = work_stealing;
+
+    cenv_batch* batch = cenv_make_batch(CENV_VERSION, num_instances, "", options, 3);
+
+    if (batch == nullptr)
+        return 0.0;
+
+    std::vector<int32_t> actions(num_instances);
+    std::vector<uint8_t> observations(num_instances * 64 * 64 * 3);
+    std::vector<float> rewards(num_instances);
+    std::unique_ptr<bool[]> terminated(new bool[num_instances]);
+    std::unique_ptr<bool[]> truncated(new bool[num_instances]);
+
+    action_state = 1;
+
+    cenv_reset_batch(batch, observations.data());
+
+    auto run = [&](int steps) {
+        for (int i = 0; i < steps; i++) {
+            for (int32_t &action : actions)
+                action = next_action();
+
+            if (async) {
+                cenv_step_batch_async(batch, actions.data(), observations.data(), rewards.data(), terminated.get(), truncated.get());
+                cenv_step_batch_wait(batch);
+            }
+            else
+                cenv_step_batch(batch, actions.data(), observations.data(), rewards.data(), terminated.get(), truncated.get());
+        }
+    };
+
+    // Warm up, the first frames size the render targets and the level layers
+    run(50);
+
+    auto start = std::chrono::steady_clock::now();
+
+    run(num_steps);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    cenv_close_batch(batch);
+
+    return static_cast<double>(num_instances) * num_steps / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    int num_instances = argc > 1 ? std::atoi(argv[1]) : 256;
+    int num_steps = argc > 2 ? std::atoi(argv[2]) : 500;
+    int max_threads = argc > 3 ? std::atoi(argv[3]) : 32;
+
+    std::cout << num_instances << " instances, " << num_steps << " steps, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl << std::endl;
+
+    std::cout << "| threads | stealing (steps/s) | static split (steps/s) | stealing / static | async (steps/s) |" << std::endl;
+    std::cout << "|--------:|-------------------:|-----------------------:|------------------:|----------------:|" << std::endl;
+
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        double stealing = measure(num_instances, num_steps, num_threads, true, false);
+        double fixed = measure(num_instances, num_steps, num_threads, false, false);
+        double async = measure(num_instances, num_steps, num_threads, true, true);
+
+        if (stealing == 0.0 || fixed == 0.0 || async == 0.0) {
+            std::cerr << "Could not make the batch (run from the repository root)" << std::endl;
+
+            return 1;
+        }
+
+        std::cout << std::fixed << std::setprecision(0) << "| " << num_threads << " | " << stealing << " | " << fixed << " | " << std::setprecision(2) << stealing / fixed << " | "
+            << std::setprecision(0) << async << " |" << std::endl;
+    }
+
+    return 0;
+}
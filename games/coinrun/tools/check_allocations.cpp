@@ -0,0 +1,178 @@
+#include "../../cenv/cenv.h"
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <new>
+
+// Checks that steps and resets do not touch the heap once the env is warmed up, for single instances and for batches
+// stepped with cenv_step_batch and cenv_step_batch_async. Counts every operator new,
+// including the ones made inside the env library. Run from the repository root (assets are loaded from there):
+//     check_allocations [num_steps]
+
+static long num_allocations = 0;
+
+void* operator new(size_t size) {
+    num_allocations++;
+
+    void* p = std::malloc(size == 0 ? 1 : size);
+
+    if (p == nullptr)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// Fixed action sequence, so every run sees the same levels
+static unsigned int action_state = 1;
+
+static int next_action() {
+    action_state = action_state * 1103515245u + 12345u;
+
+    return (action_state >> 8) % 15;
+}
+
+// Returns the allocations made by steps and by resets
+static void run(cenv_instance* instance, int num_steps, long &step_allocations, long &reset_allocations) {
+    int32_t action = 0;
+
+    cenv_key_value action_key_value;
+    action_key_value.key = "action";
+    action_key_value.value_type = CENV_VALUE_TYPE_INT;
+    action_key_value.value_buffer_size = 1;
+    action_key_value.value_buffer.i = &action;
+
+    cenv_step_data* step_data = cenv_get_step_data(instance);
+
+    for (int i = 0; i < num_steps; i++) {
+        action = next_action();
+
+        long before = num_allocations;
+
+        cenv_step_instance(instance, &action_key_value, 1);
+
+        step_allocations += num_allocations - before;
+
+        if (step_data->terminated || step_data->truncated) {
+            before = num_allocations;
+
+            cenv_reset_instance(instance, 0, nullptr, 0);
+
+            reset_allocations += num_allocations - before;
+        }
+    }
+}
+
+// Returns the allocations made by batch steps (auto-resets included), async steps are waited for right away
+static long run_batch(cenv_batch* batch, int num_steps, bool async) {
+    int num_instances = cenv_get_batch_size(batch);
+
+    std::vector<int32_t> actions(num_instances);
+    std::vector<uint8_t> observations(num_instances * 64 * 64 * 3);
+    std::vector<float> rewards(num_instances);
+    std::unique_ptr<bool[]> terminated(new bool[num_instances]);
+    std::unique_ptr<bool[]> truncated(new bool[num_instances]);
+
+    long allocations = 0;
+
+    for (int i = 0; i < num_steps; i++) {
+        for (int32_t &action : actions)
+            action = next_action();
+
+        long before = num_allocations;
+
+        if (async) {
+            cenv_step_batch_async(batch, actions.data(), observations.data(), rewards.data(), terminated.get(), truncated.get());
+            cenv_step_batch_wait(batch);
+        }
+        else
+            cenv_step_batch(batch, actions.data(), observations.data(), rewards.data(), terminated.get(), truncated.get());
+
+        allocations += num_allocations - before;
+    }
+
+    return allocations;
+}
+
+int main(int argc, char** argv) {
+    int num_steps = argc > 1 ? std::atoi(argv[1]) : 20000;
+
+    cenv_option seed_option;
+    seed_option.name = "seed";
+    seed_option.value_type = CENV_VALUE_TYPE_INT;
+    seed_option.value.i = 42;
+
+    cenv_instance* instance = cenv_make_instance(CENV_VERSION, "", &seed_option, 1);
+
+    if (instance == nullptr) {
+        std::cerr << "Could not make the env (run from the repository root)" << std::endl;
+
+        return 1;
+    }
+
+    long step_allocations = 0;
+    long reset_allocations = 0;
+
+    // Warm up, the first frames size the render targets and the level layer
+    run(instance, 1000, step_allocations, reset_allocations);
+
+    step_allocations = 0;
+    reset_allocations = 0;
+
+    run(instance, num_steps, step_allocations, reset_allocations);
+
+    // Resets that follow each other directly as well
+    for (int i = 0; i < 200; i++) {
+        long before = num_allocations;
+
+        cenv_reset_instance(instance, 0, nullptr, 0);
+
+        reset_allocations += num_allocations - before;
+    }
+
+    cenv_close_instance(instance);
+
+    std::cout << "Allocations over " << num_steps << " steps: " << step_allocations << " in steps, " << reset_allocations << " in resets" << std::endl;
+
+    // Batches, with worker threads so the pool's job hand-off is covered too
+    cenv_option batch_options[2];
+    batch_options[0] = seed_option;
+
+    batch_options[1].name = "num_threads";
+    batch_options[1].value_type = CENV_VALUE_TYPE_INT;
+    batch_options[1].value.i = 2;
+
+    const int num_instances = 8;
+    const int num_batch_steps = num_steps / num_instances;
+
+    cenv_batch* batch = cenv_make_batch(CENV_VERSION, num_instances, "", batch_options, 2);
+
+    if (batch == nullptr) {
+        std::cerr << "Could not make the batch" << std::endl;
+
+        return 1;
+    }
+
+    // Warm up both paths, the first async step starts the pool's driver thread
+    run_batch(batch, 200, false);
+    run_batch(batch, 200, true);
+
+    long batch_allocations = run_batch(batch, num_batch_steps, false);
+    long async_allocations = run_batch(batch, num_batch_steps, true);
+
+    cenv_close_batch(batch);
+
+    std::cout << "Allocations over " << num_batch_steps << " batch steps of " << num_instances << " instances: " << batch_allocations << " in cenv_step_batch, "
+        << async_allocations << " in cenv_step_batch_async" << std::endl;
+
+    return step_allocations == 0 && reset_allocations == 0 && batch_allocations == 0 && async_allocations == 0 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include "../../cenv/cenv.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+// Checks that snapshots with out of range floats are rejected, and that a rejected restore leaves the instance like
+// after a reset. Run from the repository root (assets are loaded from there):
+//     check_snapshots
+
+static int num_failures = 0;
+
+static void expect(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "Failed: " << what << std::endl;
+
+        num_failures++;
+    }
+}
+
+// Offset of the first run of floats matching pattern, NaN entries match anything
+static int find_floats(const std::vector<uint8_t> &data, const std::vector<float> &pattern) {
+    int size = pattern.size() * sizeof(float);
+
+    for (int offset = 0; offset + size <= static_cast<int>(data.size()); offset++) {
+        bool match = true;
+
+        for (int i = 0; i < pattern.size() && match; i++) {
+            float value;
+            std::memcpy(&value, data.data() + offset + i * sizeof(float), sizeof(float));
+
+            match = std::isnan(pattern[i]) || value == pattern[i];
+        }
+
+        if (match)
+            return offset;
+    }
+
+    return -1;
+}
+
+static void step(cenv_instance* instance) {
+    int32_t action = 0;
+
+    cenv_key_value action_key_value;
+    action_key_value.key = "action";
+    action_key_value.value_type = CENV_VALUE_TYPE_INT;
+    action_key_value.value_buffer_size = 1;
+    action_key_value.value_buffer.i = &action;
+
+    cenv_step_instance(instance, &action_key_value, 1);
+}
+
+// Overwrites the float at offset in a copy of state and checks that restoring it fails cleanly
+static void check_rejected(cenv_instance* instance, const std::vector<uint8_t> &state, int offset, float value, const char* what) {
+    std::vector<uint8_t> corrupt = state;
+    std::memcpy(corrupt.data() + offset, &value, sizeof(float));
+
+    cenv_step_data* step_data = cenv_get_step_data(instance);
+    cenv_key_value &observation = step_data->observations[0];
+
+    // A rejected restore has to render the observation again
+    std::memset(observation.value_buffer.b, 0, observation.value_buffer_size);
+
+    step_data->reward.f = 1.0f;
+    step_data->terminated = true;
+
+    expect(cenv_set_state_instance(instance, corrupt.data(), corrupt.size()) == 1, what);
+
+    bool rendered = false;
+
+    for (int i = 0; i < observation.value_buffer_size && !rendered; i++)
+        rendered = observation.value_buffer.b[i] != 0;
+
+    expect(rendered, "observation rendered after a rejected restore");
+    expect(step_data->reward.f == 0.0f && !step_data->terminated && !step_data->truncated, "step data cleared after a rejected restore");
+
+    // Still usable
+    step(instance);
+}
+
+int main() {
+    cenv_option seed_option;
+    seed_option.name = "seed";
+    seed_option.value_type = CENV_VALUE_TYPE_INT;
+    seed_option.value.i = 42;
+
+    cenv_instance* instance = cenv_make_instance(CENV_VERSION, "", &seed_option, 1);
+
+    if (instance == nullptr) {
+        std::cerr << "Could not make the env (run from the repository root)" << std::endl;
+
+        return 1;
+    }
+
+    // Right after a reset the agent sits at its spawn point with the default rotation and scale
+    std::vector<uint8_t> state(cenv_get_state_instance(instance, nullptr, 0));
+    cenv_get_state_instance(instance, state.data(), state.size());
+
+    const float any = std::numeric_limits<float>::quiet_NaN();
+
+    int transform = find_floats(state, { 1.5f, any, 0.0f, 1.0f });
+    int collision = find_floats(state, { -0.5f, -1.0f, 1.0f, 1.0f });
+
+    expect(transform >= 0 && collision >= 0, "agent components found in the snapshot");
+
+    if (transform >= 0 && collision >= 0) {
+        expect(cenv_set_state_instance(instance, state.data(), state.size()) == 0, "unchanged snapshot restored");
+
+        check_rejected(instance, state, transform, std::numeric_limits<float>::quiet_NaN(), "NaN position rejected");
+        check_rejected(instance, state, transform, std::numeric_limits<float>::infinity(), "infinite position rejected");
+        check_rejected(instance, state, transform, 1.0e9f, "huge position rejected");
+        check_rejected(instance, state, transform + sizeof(float), -1.0e9f, "huge negative position rejected");
+        check_rejected(instance, state, collision + 2 * sizeof(float), 1.0e9f, "huge collision bounds rejected");
+    }
+
+    cenv_close_instance(instance);
+
+    if (num_failures == 0)
+        std::cout << "Snapshot checks passed" << std::endl;
+
+    return num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,38 @@
+#include "level_pack.h"
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+// Writes a level pack for a fixed seed range, for example
+//     pack_levels levels.pack 0 100000
+// then run the env with COINRUN_LEVEL_PACK=levels.pack
+int main(int argc, char** argv) {
+    if (argc != 4) {
+        std::cerr << "Usage: pack_levels <output> <start_level> <num_levels>" << std::endl;
+
+        return 1;
+    }
+
+    std::string path(argv[1]);
+    int32_t start_level = std::atoi(argv[2]);
+    int32_t num_levels = std::atoi(argv[3]);
+
+    if (num_levels <= 0) {
+        std::cerr << "num_levels must be positive" << std::endl;
+
+        return 1;
+    }
+
+    System_Tilemap::Config config;
+
+    if (write_level_pack(path, start_level, num_levels, config) != 0) {
+        std::cerr << "Could not write " << path << std::endl;
+
+        return 1;
+    }
+
+    std::cout << "Wrote levels " << start_level << " to " << (start_level + num_levels - 1) << " to " << path << std::endl;
+
+    return 0;
+}